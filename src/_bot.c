@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include "bot.h"
+#include "log.h"
+
+// Example bot: any number of connections sharing one loop, each joining the
+// same channels, counting the chat it sees and answering it through a
+// pipeline, by default one that replies to "!ping". "!stats" is answered by
+// a trigger. With -m N it sits in the channels a loadgen with the same -m
+// and -g talks in.
+
+
+
+#define MAX_CHANNELS 4096
+
+const char *host = "127.0.0.1";
+int port = 9998;
+int num_bots = 1;
+const char *nick = "bot";
+const char *channels[MAX_CHANNELS];
+int num_channels;
+
+const char *default_spec =
+  "chat filter command=PRIVMSG ! -\n"
+  "ping match prefix=!ping\n"
+  "pong reply text=pong\n";
+
+uint64_t privmsgs;
+
+
+
+void on_privmsg(Bot *bot, Message *m, void *arg) {
+  privmsgs++;
+}
+
+
+
+char *read_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  if(!f) return NULL;
+
+  size_t len = 0, cap = 4096;
+  char *s = malloc(cap);
+  size_t n;
+  while(s && (n = fread(s + len, 1, cap - len - 1, f)) > 0) {
+    len += n;
+    if(len + 1 == cap && !(s = realloc(s, cap *= 2))) break;
+  }
+  fclose(f);
+  if(s) s[len] = 0;
+  return s;
+}
+
+
+
+void on_stats(Bot *bot, Message *m, void *arg) {
+  char text[64];
+  snprintf(text, sizeof(text), "%"PRIu64" messages seen", privmsgs);
+  bot_privmsg(bot, BOT_LANE_CHAT, m->args[0][0] == '#' ? m->args[0] : m->prefix.nick, text);
+}
+
+
+
+void on_welcome(Bot *bot, Message *m, void *arg) {
+  LOG(LOG_INFO, "%s: registered", bot->config.nick);
+}
+
+
+
+int main(int argc, char *argv[]) {
+  const char *prefix = "lg";
+  const char *spec = default_spec;
+  int lg_channels = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "h:p:b:n:c:m:g:f:l:")) != -1) {
+    switch(opt) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'b': num_bots = atoi(optarg); break;
+    case 'n': nick = optarg; break;
+    case 'c':
+      if(num_channels == MAX_CHANNELS) goto usage;
+      channels[num_channels++] = optarg;
+      break;
+    case 'm': lg_channels = atoi(optarg); break;
+    case 'g': prefix = optarg; break;
+    case 'f':
+      if(!(spec = read_file(optarg))) {
+        perror(optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'l':
+      if((log_level = log_level_named(optarg)) < 0) goto usage;
+      break;
+    default: goto usage;
+    }
+  }
+  if(num_bots < 1 || lg_channels < 0) goto usage;
+
+  Bot *bots = calloc(num_bots, sizeof(Bot));
+  char (*nicks)[32] = calloc(num_bots, sizeof(*nicks));
+  Pipeline *pipelines = calloc(num_bots, sizeof(Pipeline));
+  BotLoop loop;
+  if(!bots || !nicks || !pipelines || !bot_loop_init(&loop)) {
+    perror("setup");
+    return EXIT_FAILURE;
+  }
+  log_start();
+
+  for(int i = 0; i < num_bots; i++) {
+    if(num_bots == 1) snprintf(nicks[i], sizeof(nicks[i]), "%s", nick);
+    else snprintf(nicks[i], sizeof(nicks[i]), "%s-%d", nick, i);
+    BotConfig config = { .host = host, .port = port, .nick = nicks[i] };
+
+    int line;
+    pipeline_init(&pipelines[i], NULL, NULL);
+    if(!pipeline_load(&pipelines[i], spec, &line)) {
+      fprintf(stderr, "Bad pipeline, line %d\n", line);
+      return EXIT_FAILURE;
+    }
+
+    Bot *bot = &bots[i];
+    bool ok = bot_init(bot, &config) &&
+      bot_on(bot, "PRIVMSG", on_privmsg, NULL) &&
+      bot_on(bot, "001", on_welcome, NULL) &&
+      bot_trigger(bot, TRIGGER_COMMAND, "!stats", on_stats, NULL) &&
+      bot_loop_add(&loop, bot);
+    bot_use(bot, &pipelines[i]);
+    for(int k = 0; ok && k < num_channels; k++) ok = bot_join(bot, channels[k]);
+    for(int k = 0; ok && k < lg_channels; k++) {
+      char name[64];
+      snprintf(name, sizeof(name), "#%s-%d", prefix, k);
+      ok = bot_join(bot, name);
+    }
+    if(!ok) {
+      perror("bot");
+      return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t report = bot_now() + 1000000000ull;
+  uint64_t last = 0;
+  while(1) {
+    bot_loop_run(&loop, 100);
+
+    uint64_t now = bot_now();
+    if(now < report) continue;
+    report = now + 1000000000ull;
+    LOG(LOG_INFO, "%"PRIu64" PRIVMSG/s, %"PRIu64" total", privmsgs - last, privmsgs);
+    last = privmsgs;
+  }
+
+usage:
+  fprintf(stderr,
+      "Usage: %s [-h host] [-p port] [-b bots] [-n nick] [-c channel]...\n"
+      "       [-m loadgen channels] [-g loadgen prefix] [-f pipeline file] [-l log level]\n", argv[0]);
+  return EXIT_FAILURE;
+}
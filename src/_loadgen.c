@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "linebuf.h"
+#include "message.h"
+
+// Load generator: registers clients, spreads them over channels and has
+// each send PRIVMSGs at a fixed rate. Every message carries its send time,
+// so every member that receives it measures the delivery latency.
+
+
+
+#define OUT_SIZE 4096
+#define SETUP_TIMEOUT_NS 10000000000ull
+#define MAX_EVENTS 256
+
+typedef struct {
+  int fd;
+  int channel;
+  bool ready;  // Registered and saw its own JOIN
+  bool closed;
+  bool writing; // Waiting for EPOLLOUT
+  uint64_t next_send;
+  size_t out_len;
+  char out[OUT_SIZE];
+  LineBuf in;
+} Client;
+
+const char *host = "127.0.0.1";
+int port = 9998;
+int num_clients = 100;
+int num_channels = 10;
+double rate = 1;       // Messages per second per client
+double duration = 10;  // Seconds of sending
+double drain = 2;      // Seconds to wait for stragglers afterwards
+double late_ms = 1000; // Deliveries slower than this count as late
+const char *prefix = "lg";
+
+Client *clients;
+int *members;  // Ready clients per channel
+int epfd;
+
+struct {
+  uint64_t sent;
+  uint64_t stalled; // Not sent because the client's output was backed up
+  uint64_t expected;
+  uint64_t received;
+  uint64_t late;
+  int ready;
+  int disconnected;
+} stats;
+
+// Delivery latencies in microseconds
+uint32_t *lat;
+size_t lat_len;
+size_t lat_cap;
+
+
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+void client_close(Client *c) {
+  if(c->closed) return;
+  c->closed = true;
+  close(c->fd);
+  stats.disconnected++;
+  if(c->ready) members[c->channel]--;
+}
+
+
+
+void client_watch(Client *c, bool out) {
+  if(c->writing == out) return;
+  c->writing = out;
+  struct epoll_event ev = {
+    .events = EPOLLIN | EPOLLRDHUP | (out ? EPOLLOUT : 0),
+    .data.ptr = c,
+  };
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+
+void client_flush(Client *c) {
+  size_t off = 0;
+  while(off < c->out_len) {
+    ssize_t n = send(c->fd, c->out + off, c->out_len - off, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0 && errno == EAGAIN) break;
+    if(n <= 0) {
+      client_close(c);
+      return;
+    }
+    off += n;
+  }
+
+  memmove(c->out, c->out + off, c->out_len - off);
+  c->out_len -= off;
+  client_watch(c, c->out_len > 0);
+}
+
+
+
+// Returns false if the client's output is backed up
+bool client_send(Client *c, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(c->out + c->out_len, OUT_SIZE - c->out_len, fmt, args);
+  va_end(args);
+  if(n < 0 || n >= OUT_SIZE - c->out_len) return false;
+
+  bool idle = c->out_len == 0;
+  c->out_len += n;
+  if(idle) client_flush(c);
+  return true;
+}
+
+
+
+void record(uint64_t sent_ns, uint64_t now) {
+  uint64_t us = now > sent_ns ? (now - sent_ns) / 1000 : 0;
+  if(us > late_ms * 1000) stats.late++;
+
+  if(lat_len == lat_cap) {
+    lat_cap = lat_cap ? lat_cap * 2 : 1 << 16;
+    lat = realloc(lat, lat_cap * sizeof(uint32_t));
+    if(!lat) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  lat[lat_len++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+
+
+void client_line(Client *c, char *line, size_t len) {
+  Message m;
+  if(!message_parse(&m, line, len)) return;
+
+  if(!strcmp(m.command, "JOIN")) {
+    // The server echoes our own JOIN once we are in
+    if(!c->ready && m.prefix.nick && !strncmp(m.prefix.nick, prefix, strlen(prefix)) &&
+        atoi(m.prefix.nick + strlen(prefix) + 1) == c - clients) {
+      c->ready = true;
+      members[c->channel]++;
+      stats.ready++;
+    }
+  } else if(!strcmp(m.command, "PRIVMSG") && m.num_args == 2) {
+    stats.received++;
+    record(strtoull(m.args[1], NULL, 10), now_ns());
+  }
+}
+
+
+
+void client_input(Client *c) {
+  ssize_t n;
+  while((n = linebuf_read(&c->in, c->fd)) > 0) {
+    char *line;
+    size_t len;
+    while((line = linebuf_next(&c->in, &len))) client_line(c, line, len);
+  }
+  if(n == 0 || errno != EAGAIN) client_close(c);
+}
+
+
+
+// Handle everything that is ready, waiting up to timeout_ms for the first
+void poll_once(int timeout_ms) {
+  struct epoll_event events[MAX_EVENTS];
+  int n;
+  do {
+    n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+    for(int i = 0; i < n; i++) {
+      Client *c = events[i].data.ptr;
+      if(c->closed) continue;
+      if(events[i].events & EPOLLOUT) client_flush(c);
+      if(!c->closed && events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        client_input(c);
+      }
+    }
+    timeout_ms = 0;
+  } while(n == MAX_EVENTS);
+}
+
+
+
+// Handle socket events until deadline or until done() says to stop
+void pump(uint64_t deadline, bool (*done)(void)) {
+  while(now_ns() < deadline && !done()) poll_once(1);
+}
+
+
+
+bool all_ready(void) {
+  return stats.ready + stats.disconnected >= num_clients;
+}
+
+
+
+bool all_received(void) {
+  return stats.received >= stats.expected;
+}
+
+
+
+bool client_connect(Client *c, int i, struct sockaddr_in *addr) {
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(c->fd < 0) return false;
+  if(connect(c->fd, (struct sockaddr *)addr, sizeof(*addr)) != 0) {
+    close(c->fd);
+    return false;
+  }
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = c };
+  if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+    close(c->fd);
+    return false;
+  }
+
+  c->channel = i % num_channels;
+  client_send(c, "NICK %s-%d\r\nUSER %s load.gen * :Load generator\r\nJOIN #%s-%d\r\n",
+      prefix, i, prefix, prefix, c->channel);
+  return true;
+}
+
+
+
+int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+
+void report(double elapsed) {
+  qsort(lat, lat_len, sizeof(uint32_t), cmp_u32);
+#define PCT(p) (lat_len ? lat[(size_t)((lat_len - 1) * (p))] / 1000.0 : 0)
+
+  uint64_t dropped = stats.expected > stats.received ? stats.expected - stats.received : 0;
+  printf("clients      %d ready, %d disconnected, %d channels\n",
+      stats.ready, stats.disconnected, num_channels);
+  printf("sent         %"PRIu64" (%.0f/s), %"PRIu64" stalled\n",
+      stats.sent, stats.sent / elapsed, stats.stalled);
+  printf("delivered    %"PRIu64" of %"PRIu64" expected (%.0f/s), %"PRIu64" dropped, %"PRIu64" late\n",
+      stats.received, stats.expected, stats.received / elapsed, dropped, stats.late);
+  printf("latency ms   p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+      PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), PCT(1));
+#undef PCT
+}
+
+
+
+// Raise the soft fd limit as far as the hard one allows. Returns false if
+// that still leaves no room for every client.
+bool raise_fd_limit(int needed) {
+  struct rlimit lim;
+  if(getrlimit(RLIMIT_NOFILE, &lim) < 0) return true;
+  if(lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    getrlimit(RLIMIT_NOFILE, &lim);
+  }
+  if(lim.rlim_cur != RLIM_INFINITY && lim.rlim_cur < needed) {
+    fprintf(stderr, "%d clients need %d fds, but the limit is %llu\n",
+        num_clients, needed, (unsigned long long)lim.rlim_cur);
+    return false;
+  }
+  return true;
+}
+
+
+
+int main(int argc, char *argv[]) {
+  int opt;
+  while((opt = getopt(argc, argv, "h:p:c:m:r:d:w:l:n:")) != -1) {
+    switch(opt) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'c': num_clients = atoi(optarg); break;
+    case 'm': num_channels = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'w': drain = atof(optarg); break;
+    case 'l': late_ms = atof(optarg); break;
+    case 'n': prefix = optarg; break;
+    default: goto usage;
+    }
+  }
+  // Above 1e9 per second the send interval rounds to 0 ns
+  if(num_clients < 1 || num_channels < 1 || rate <= 0 || rate > 1e9 || duration <= 0) goto usage;
+  // One per client, plus stdio and the epoll fd
+  if(!raise_fd_limit(num_clients + 8)) return EXIT_FAILURE;
+
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+  if(inet_pton(AF_INET, host, &addr.sin_addr) != 1) goto usage;
+
+  clients = calloc(num_clients, sizeof(Client));
+  members = calloc(num_channels, sizeof(int));
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(!clients || !members || epfd < 0) {
+    perror("setup");
+    return EXIT_FAILURE;
+  }
+
+  // Keep up with the server's replies while connecting
+  for(int i = 0; i < num_clients; i++) {
+    if(!client_connect(&clients[i], i, &addr)) {
+      perror("connect");
+      clients[i].closed = true;
+      stats.disconnected++;
+    }
+    if(i % 64 == 63) poll_once(0);
+  }
+  pump(now_ns() + SETUP_TIMEOUT_NS, all_ready);
+  if(!stats.ready) {
+    fprintf(stderr, "No client registered\n");
+    return EXIT_FAILURE;
+  }
+
+  // Spread the first sends over one interval so clients don't send in step
+  uint64_t interval = 1e9 / rate;
+  uint64_t start = now_ns();
+  for(int i = 0; i < num_clients; i++) {
+    clients[i].next_send = start + (uint64_t)rand() % interval;
+  }
+
+  uint64_t end = start + duration * 1e9;
+  uint64_t now;
+  while((now = now_ns()) < end) {
+    for(Client *c = clients; c < clients + num_clients; c++) {
+      if(!c->ready || c->closed || c->next_send > now) continue;
+      // Don't burst to catch up after a stall
+      c->next_send = c->next_send + interval < now ? now + interval : c->next_send + interval;
+
+      if(!client_send(c, "PRIVMSG #%s-%d :%"PRIu64"\r\n", prefix, c->channel, now_ns())) {
+        stats.stalled++;
+        continue;
+      }
+      stats.sent++;
+      stats.expected += members[c->channel] - 1;
+    }
+    poll_once(1);
+  }
+  double elapsed = (now_ns() - start) / 1e9;
+
+  pump(now_ns() + drain * 1e9, all_received);
+  report(elapsed);
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr,
+      "Usage: %s [-h host] [-p port] [-c clients] [-m channels] [-r msgs/s per client]\n"
+      "       [-d seconds] [-w drain seconds] [-l late ms] [-n nick prefix]\n", argv[0]);
+  return EXIT_FAILURE;
+}
@@ -3,15 +3,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include "message.h"
+#include "samples.h"
 
 char buffer[MESSAGE_MAX_LEN+1] = {};
 
 void parse_message(char *raw) {
-  Message m = message_new(raw);
+  // message_new() parses in place, so work on a copy of the literal
+  static char line[MESSAGE_MAX_LEN+1];
+  snprintf(line, sizeof(line), "%s", raw);
+  Message m = message_new(line);
 
   printf("Raw: %s\n", raw);
   printf("Tags:\n");
-  for(int i = 0; i < MESSAGE_MAX_TAGS && m.tags[i].key; i++) {
+  for(int i = 0; i < message_tags(&m); i++) {
     printf("  %s=%s\n", m.tags[i].key, m.tags[i].value);
   }
   printf("Prefix:\n");
@@ -20,25 +24,20 @@ void parse_message(char *raw) {
   printf("  host: %s\n", m.prefix.host);
   printf("Command: %s\n", m.command);
   printf("Arguments:\n");
-  for(int i = 0; i < MESSAGE_MAX_ARGS && m.args[i]; i++) {
+  for(int i = 0; i < m.num_args; i++) {
     printf("  %s\n", m.args[i]);
   }
 
-  message_tostring(&m, buffer, MESSAGE_MAX_LEN+1);
+  message_tostring(&m, buffer, MESSAGE_MAX_LEN+1, NULL);
   printf("Raw: %s\n", buffer);
 
   message_free(&m);
 }
 
 char *test_messages[] = {
-  "@badge-info=subscriber/1;badges=subscriber/0;color=;display-name=DinkSmaIIwood;emote-sets=0,97129,111925;mod=0;subscriber=1;user-type= :tmitest-test.twitch.tv USERSTATE #misterscoot",
-  "@badge-info=founder/34;badges=moderator/1,founder/0,premium/1;color=#8A2BE2;display-name=FatalPierce;emote-only=1;emotes=300462338:0-9;flags=;id=a6ec9527-63bb-47e1-9668-8ddbdf2607ea;mod=1;room-id=100327976;subscriber=0;tmi-sent-ts=1589506867207;turbo=0;user-id=83894115;user-type=mod :fatalpierce!fatalpierce@fatalpierce.tmi.twitch.tv PRIVMSG #misterscoot :gloopdRock",
-  ":nick!user COMMAND",
-  ":nick@host.name COMMAND",
-  ":nick!user@host.name COMMAND",
-  ":nick COMMAND",
-  ":host.host COMMAND",
-  ":nick!user@host.host PRIVMSG #channel :This is a test message",
+#define X(s) s,
+SAMPLE_MESSAGES
+#undef X
 };
 
 
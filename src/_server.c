@@ -1,15 +1,34 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <resolv.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <strings.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <ctype.h>
 #include "message.h"
+#include "io.h"
+#include "mpsc.h"
+#include "channel.h"
+#include "nick.h"
+#include "atom.h"
+#include "slab.h"
+#include "phash.h"
+#include "metrics.h"
+#include "log.h"
+#include "snapshot.h"
 #include "util.h"
 
 
@@ -17,38 +36,63 @@
 #define PORT 9998
 #define SERVER_HOST "the.server"
 #define MAX_CHANNELS 16
-#define MAX_CLIENTS 128
-
-#define PREFIX_FMT ":%s!%s@%s "
-#define PREFIX_MEMB(c) c->nick, c->user, c->host
+#define MAX_SHARDS 64
+#define RESTART_TIMEOUT_MS 10000
 
 
 
 enum {
   CLIENT_STATUS_DISCONNECTED = 0,
+  CLIENT_STATUS_CLOSING,
   CLIENT_STATUS_WAIT_NICK,
   CLIENT_STATUS_WAIT_USER,
   CLIENT_STATUS_OK
 };
 
+struct Shard;
+
+// Cold client state: identity and channel memberships, only touched by the
+// commands that change them
+typedef struct {
+  Atom *nick;
+  Atom *user;
+  Atom *host;
+  // ":nick!user@host ", built at registration and on every nick change
+  char *prefix;
+  size_t prefix_len;
+  Membership channels[MAX_CHANNELS];
+} ClientInfo;
+
+// Hot client state, touched for every line received and every delivery.
+// Lives in column 0 of the shard's client slab; info is the same slot in
+// column 1. conn must stay first: backends hand back the Conn and we cast it.
 typedef struct {
-  int sock;
+  Conn conn;
   int status;
-
-  char *nick;
-  char *user;
-  char *host;
-  char *channels[MAX_CHANNELS];
+  SlabHandle handle;
+  struct Shard *home;
+  ClientInfo *info;
 } Client;
 
+enum {
+  CLIENT_COLUMN_HOT,
+  CLIENT_COLUMN_INFO
+};
+
 
 
 typedef void(*ClientCommand)(Client *c, Message *m);
 
-Client *client_new();
+Client *client_new(int fd);
+Client *client_by_fd(int fd);
 void client_free(Client *c);
-int client_service(Client *c);
-bool client_in_channel(Client *c, char *channel);
+Conn *client_accept(int fd);
+int client_service(Conn *conn);
+void client_release(Conn *conn);
+bool client_in_channel(Client *c, Atom *channel);
+Membership *client_membership(Client *c, Channel *ch);
+bool client_set_prefix(Client *c);
+void client_build(Client *c, MessageBuilder *b, char *buf, const char *command);
 
 #define COMMANDS \
 X(nick, 1) \
@@ -56,100 +100,327 @@ X(user, 4) \
 X(join, 1) \
 X(part, 1) \
 X(privmsg, 2) \
-X(quit, 0)
+X(notice, 2) \
+X(quit, 0) \
+X(stats, 0)
 
 #define X(c,...) void client_##c(Client *c, Message *m);
 COMMANDS
 #undef X
 
+const char *const client_command_names[] = {
+#define X(c,...) #c,
+COMMANDS
+#undef X
+};
+
 struct {
-  const char *command;
   ClientCommand func;
   int min_args;
 } client_commands[] = {
-#define X(c,args,...) { .command=#c, .func=client_##c, .min_args=args },
+#define X(c,args,...) { .func=client_##c, .min_args=args },
 COMMANDS
 #undef X
 };
 
-Client clients[MAX_CLIENTS];
+_Static_assert(sizeof(client_command_names) / sizeof(client_command_names[0]) <= METRICS_COMMANDS,
+    "METRICS_COMMANDS can't count every command");
+
+// Built from COMMANDS at startup; C can't hash a string literal at compile
+// time, so the seed search runs once in main()
+PHash client_command_hash;
+
+#define ERRORS \
+X(UNKNOWNCOMMAND, 421, "Unknown command") \
+X(NEEDMOREPARAMS, 461, "Not enough parameters")
+
+enum {
+#define X(name,num,...) ERR_##name = num,
+ERRORS
+#undef X
+};
+
+void client_error(Client *c, int numeric, const char *command);
 
+enum {
+  RPL_STATSCOMMANDS = 212,
+  RPL_ENDOFSTATS = 219,
+  RPL_STATSDEBUG = 249
+};
+
+typedef void (*StatsEmit)(void *arg, int numeric, const char *text);
+void stats_report(char query, StatsEmit emit, void *arg);
+
+// Set by SIGUSR1; the first shard dumps the stats to stderr when woken
+volatile sig_atomic_t stats_dump_requested;
+
+// Set by SIGUSR2; the first shard then stops every shard, snapshots the
+// clients and hands them with their sockets to a new copy of the binary.
+// Each shard takes part from its wake handler while restarting is set.
+volatile sig_atomic_t restart_requested;
+atomic_bool restarting;
+pthread_barrier_t restart_barrier;
+char **server_argv;
+
+// The snapshot this process was started with, if any
+char *restore_data;
+int *restore_fds;
+
+// A delivery handed from one shard to another: either buf to the shard's
+// members of channel, or msg to the client behind target if it is still
+// live. buf is the sender's buffer, shared by every shard it goes to.
+typedef struct {
+  MpscNode node;
+  Atom *channel;
+  WireBuf *buf;
+  SlabHandle target;
+  size_t len;
+  char msg[];
+} ShardMsg;
+
+// Each worker thread owns one shard: its listener, its clients and an inbox
+// for deliveries from other shards. Nothing in a shard is touched by other
+// threads except through the inbox.
+typedef struct Shard {
+  pthread_t thread;
+  int listen_fd;
+  int wake_fd;
+  Mpsc inbox;
+  ChannelTable channels;
+
+  Slab clients;
+  Client **by_fd;
+  size_t by_fd_cap;
+
+  // Scratch space for handling one line, reset once it is dispatched
+  Arena arena;
+
+  // This shard's clients in a snapshot being taken, and their fds
+  SnapWriter snap;
+  int *snap_fds;
+  uint32_t num_snap_fds;
+
+  // Clients handed over by the previous process, for the shard to restore
+  SnapReader restore;
+  int *restore_fds;
+  uint32_t num_restore;
+} Shard;
+
+Shard *shards;
+int num_shards = 1;
+int port = PORT;
+_Thread_local Shard *shard;
+
+// Guards the nick registry. A registered client's nick, handle and home
+// may be read by any thread holding it.
+pthread_mutex_t nick_lock = PTHREAD_MUTEX_INITIALIZER;
+NickTable nicks;
+
+IoBackend *io_default;
+_Thread_local IoBackend *io;
+
+void shard_wake(void);
+void *shard_run(void *arg);
+
+IoHandler io_handler = {
+  .accept = client_accept,
+  .input = client_service,
+  .release = client_release,
+  .wake = shard_wake,
+};
 
 
-int read_line(int fd, char *buffer, size_t n);
-void inspect(char *s);
+
+void client_line(Client *c, char *line, size_t len);
 
 void say(Client *c, char *fmt, ...);
 void say_str(Client *c, char *msg, size_t len);
+void say_shared(Client *c, WireBuf *buf);
 void say_message(Client *c, Message *m);
 
-void broadcast(Client *except, char *channel, char *fmt, ...);
-void broadcast_str(Client *except, char *channel, char *msg, size_t len);
-void broadcast_message(Client *except, char *channel, Message *m);
+void broadcast_str(Client *except, Atom *channel, char *msg, size_t len);
+void broadcast_local(Client *except, Atom *channel, WireBuf *buf);
+void broadcast_message(Client *except, Atom *channel, Message *m);
 
+void client_join_one(Client *c, char *channel, size_t len);
+void client_message(Client *c, Message *m, const char *command, bool reply_errors);
+void deliver(Shard *sh, SlabHandle target, char *msg, size_t len);
 
 
 
-Client *client_new() {
-  Client *c = NULL;
 
-  for(int i = 0; i < MAX_CLIENTS; i++) {
-    if(clients[i].status != CLIENT_STATUS_DISCONNECTED) continue;
-    c = &clients[i];
-    break;
+Client *client_new(int fd) {
+  if(fd >= shard->by_fd_cap) {
+    size_t cap = shard->by_fd_cap ? shard->by_fd_cap : 1024;
+    while(cap <= fd) cap *= 2;
+    Client **by_fd = realloc(shard->by_fd, cap * sizeof(Client *));
+    if(!by_fd) return NULL;
+    memset(by_fd + shard->by_fd_cap, 0, (cap - shard->by_fd_cap) * sizeof(Client *));
+    shard->by_fd = by_fd;
+    shard->by_fd_cap = cap;
   }
 
-  if(!c) {
-    printf("Max clients reached!\n");
+  SlabHandle h = slab_alloc(&shard->clients);
+  if(!h) {
+    LOG(LOG_ERROR, "Out of memory for clients");
     return NULL;
   }
 
-  *c = (Client){};
+  Client *c = slab_at(&shard->clients, CLIENT_COLUMN_HOT, SLAB_INDEX(h));
+  c->handle = h;
+  c->home = shard;
+  c->info = slab_at(&shard->clients, CLIENT_COLUMN_INFO, SLAB_INDEX(h));
+  c->conn.fd = fd;
+  shard->by_fd[fd] = c;
   return c;
 }
 
 
 
+Client *client_by_fd(int fd) {
+  return fd >= 0 && fd < shard->by_fd_cap ? shard->by_fd[fd] : NULL;
+}
+
+
+
 void client_free(Client *c) {
-  free(c->nick);
-  free(c->user);
-  free(c->host);
-  for(int i = 0; i < MAX_CHANNELS; i++) free(c->channels[i]);
-  *c = (Client){};
+  for(int i = 0; i < MAX_CHANNELS; i++) channel_leave(&shard->channels, &c->info->channels[i]);
+
+  pthread_mutex_lock(&nick_lock);
+  if(c->info->nick && nick_find(&nicks, c->info->nick) == c) nick_remove(&nicks, c->info->nick);
+  pthread_mutex_unlock(&nick_lock);
+
+  if(c->info->nick) atom_release(c->info->nick);
+  if(c->info->user) atom_release(c->info->user);
+  if(c->info->host) atom_release(c->info->host);
+  free(c->info->prefix);
+
+  if(client_by_fd(c->conn.fd) == c) shard->by_fd[c->conn.fd] = NULL;
+  slab_free(&shard->clients, c->handle);
 }
 
 
 
-bool client_in_channel(Client *c, char *channel) {
+Membership *client_membership(Client *c, Channel *ch) {
+  if(!ch) return NULL;
   for(int i = 0; i < MAX_CHANNELS; i++) {
-    if(!c->channels[i]) continue;
-    if(!strcasecmp(c->channels[i], channel)) return true;
+    if(c->info->channels[i].channel == ch) return &c->info->channels[i];
   }
-  return false;
+  return NULL;
 }
 
 
 
-int client_service(Client *c) {
-  if(c->status == CLIENT_STATUS_DISCONNECTED) return -1;
+bool client_in_channel(Client *c, Atom *channel) {
+  return client_membership(c, channel_find(&shard->channels, channel)) != NULL;
+}
 
-  static char buffer[MESSAGE_MAX_LEN+1];
-  if(read_line(c->sock, buffer, MESSAGE_MAX_LEN) < 1) return -1;
-  inspect(buffer);
 
-  Message m = message_new(buffer);
-  if(!m.valid) goto done;
 
-  for(int i = 0; i < sizeof(client_commands) / sizeof(client_commands[0]); i++) {
-    if(!strcasecmp(m.command, client_commands[i].command) &&
-        m.num_args >= client_commands[i].min_args) {
-      client_commands[i].func(c, &m);
-    }
+bool client_set_prefix(Client *c) {
+  char buf[MESSAGE_MAX_LEN];
+  MessageBuilder b;
+  message_build_init(&b, buf, sizeof(buf));
+  message_build_prefix(&b, c->info->nick->name, c->info->user->name, c->info->host->name);
+  if(b.overflow) return false;
+
+  char *prefix = realloc(c->info->prefix, b.len);
+  if(!prefix) return false;
+  memcpy(prefix, buf, b.len);
+  c->info->prefix = prefix;
+  c->info->prefix_len = b.len;
+  return true;
+}
+
+
+
+// Start a line from c into buf, which holds MESSAGE_MAX_LEN bytes
+void client_build(Client *c, MessageBuilder *b, char *buf, const char *command) {
+  message_build_init(b, buf, MESSAGE_MAX_LEN);
+  message_build_raw(b, c->info->prefix, c->info->prefix_len);
+  message_build_command(b, command);
+}
+
+
+
+Conn *client_accept(int fd) {
+  Client *c = client_new(fd);
+  if(!c) return NULL;
+
+  LOG(LOG_DEBUG, "Accepting new connection on socket %d", fd);
+  c->status = CLIENT_STATUS_WAIT_NICK;
+  return &c->conn;
+}
+
+
+
+// Service every complete line the backend has buffered for this client.
+// A client whose replies are backing up is not served until they drain.
+int client_service(Conn *conn) {
+  Client *c = (Client *)conn;
+
+  char *line;
+  size_t len;
+  while(c->status != CLIENT_STATUS_CLOSING && !io_backlogged(conn) &&
+      (line = linebuf_next(&conn->in, &len))) {
+    client_line(c, line, len);
   }
 
+  return c->status == CLIENT_STATUS_CLOSING ? -1 : 0;
+}
+
+
+
+void client_release(Conn *conn) {
+  client_free((Client *)conn);
+}
+
+
+
+void client_line(Client *c, char *line, size_t len) {
+  LOG_LINE(LOG_TRACE, "<<", line, len);
+  metric_add(&metrics.lines_in, 1);
+  metric_add(&metrics.bytes_in, len);
+
+  uint64_t start = metrics_now();
+  Message m;
+  if(!message_parse(&m, line, len)) {
+    metric_add(&metrics.parse_failures, 1);
+    goto done;
+  }
+  uint64_t parsed = metrics_now();
+  hist_record(&metrics.parse_ns, parsed - start);
+
+  int i = phash_find(&client_command_hash, m.command, m.command_len);
+  if(i < 0) {
+    metric_add(&metrics.unknown_commands, 1);
+    client_error(c, ERR_UNKNOWNCOMMAND, m.command);
+  } else if(m.num_args < client_commands[i].min_args) {
+    metric_add(&metrics.commands[i], 1);
+    client_error(c, ERR_NEEDMOREPARAMS, m.command);
+  } else {
+    metric_add(&metrics.commands[i], 1);
+    client_commands[i].func(c, &m);
+  }
+  hist_record(&metrics.dispatch_ns, metrics_now() - parsed);
+
 done:
   message_free(&m);
-  return 0;
+  arena_reset(&shard->arena);
+}
+
+
+
+void client_error(Client *c, int numeric, const char *command) {
+  const char *text = "";
+  switch(numeric) {
+#define X(name,num,str) case num: text = str; break;
+ERRORS
+#undef X
+  }
+
+  say(c, ":"SERVER_HOST" %03d %s %s :%s",
+      numeric, c->info->nick ? c->info->nick->name : "*", command, text);
 }
 
 
@@ -163,25 +434,48 @@ void client_nick(Client *c, Message *m) {
       break;
     }
 
-    for(Client *o = clients; o < clients + MAX_CLIENTS; o++) {
-      if(o->status >= CLIENT_STATUS_WAIT_USER && !strcasecmp(m->args[0], o->nick)) {
-        say(c, "%s 433 :Nickname already in use", m->args[0]);
-        return;
-      }
+    Atom *nick = atom_intern(m->args[0], m->args_len[0]);
+    if(!nick) break;
+
+    // Nicks are only set under the lock, so check and claim in one go.
+    // A client may change the case of its own nick.
+    pthread_mutex_lock(&nick_lock);
+    Client *owner = nick_find(&nicks, nick);
+    if(owner && owner != c) {
+      pthread_mutex_unlock(&nick_lock);
+      atom_release(nick);
+      say(c, "%s 433 :Nickname already in use", m->args[0]);
+      return;
     }
+    Atom *old = c->info->nick;
+    if(old) nick_remove(&nicks, old);
+    if(!nick_add(&nicks, nick, c)) {
+      // Removing the old nick freed its slot, so it always goes back
+      if(old) nick_add(&nicks, old, c);
+      pthread_mutex_unlock(&nick_lock);
+      atom_release(nick);
+      say(c, "%s 437 :Nick is temporarily unavailable", m->args[0]);
+      return;
+    }
+    c->info->nick = nick;
+    pthread_mutex_unlock(&nick_lock);
 
     if(c->status == CLIENT_STATUS_WAIT_NICK) {
-      replace(&c->nick, strdup(m->args[0]));
       c->status = CLIENT_STATUS_WAIT_USER;
-    } else {
+    } else if(c->status == CLIENT_STATUS_OK) {
+      // Announced under the old prefix, which is then rebuilt
+      char line[MESSAGE_MAX_LEN];
+      MessageBuilder b;
+      client_build(c, &b, line, "NICK");
+      message_build_param(&b, nick->name, nick->len);
+      size_t len = message_build_end(&b);
       for(int i = 0; i < MAX_CHANNELS; i++) {
-        if(!c->channels[i]) continue;
-        broadcast(c, c->channels[i],
-            ":%s NICK %s\r\n",
-            c->nick, m->args[0]);
+        if(!c->info->channels[i].channel) continue;
+        broadcast_str(c, c->info->channels[i].channel->name, line, len);
       }
-      replace(&c->nick, strdup(m->args[0]));
+      if(!client_set_prefix(c)) c->status = CLIENT_STATUS_CLOSING;
     }
+    if(old) atom_release(old);
     break;
 
   default:
@@ -194,14 +488,18 @@ void client_nick(Client *c, Message *m) {
 void client_user(Client *c, Message *m) {
   switch(c->status) {
   case CLIENT_STATUS_WAIT_USER:
-    replace(&c->user, strdup(m->args[0]));
-    replace(&c->host, strdup(m->args[1]));
+    c->info->user = atom_intern(m->args[0], m->args_len[0]);
+    c->info->host = atom_intern(m->args[1], m->args_len[1]);
+    if(!c->info->user || !c->info->host || !client_set_prefix(c)) {
+      c->status = CLIENT_STATUS_CLOSING;
+      break;
+    }
     c->status = CLIENT_STATUS_OK;
 
-    say(c, ":"SERVER_HOST" 001 %s :You", c->nick);
-    say(c, ":"SERVER_HOST" 002 %s :are", c->nick);
-    say(c, ":"SERVER_HOST" 003 %s :now", c->nick);
-    say(c, ":"SERVER_HOST" 004 %s :connected", c->nick);
+    say(c, ":"SERVER_HOST" 001 %s :You", c->info->nick->name);
+    say(c, ":"SERVER_HOST" 002 %s :are", c->info->nick->name);
+    say(c, ":"SERVER_HOST" 003 %s :now", c->info->nick->name);
+    say(c, ":"SERVER_HOST" 004 %s :connected", c->info->nick->name);
     break;
 
   default:
@@ -211,32 +509,52 @@ void client_user(Client *c, Message *m) {
 
 
 
+// Takes a comma-separated list, as clients that batch their joins send
 void client_join(Client *c, Message *m) {
-  if(!message_is_channel_valid(m->args[0])) {
-    say(c, ":"SERVER_HOST" 403 %s :Invalid channel name", c->nick);
+  char *name = m->args[0];
+  char *end = name + m->args_len[0];
+  while(name < end) {
+    char *comma = memchr(name, ',', end - name);
+    if(comma) *comma = '\0';
+    size_t len = comma ? comma - name : end - name;
+    client_join_one(c, name, len);
+    name += len + 1;
+  }
+}
+
+
+
+void client_join_one(Client *c, char *channel, size_t len) {
+  if(!message_is_channel_valid(channel)) {
+    say(c, ":"SERVER_HOST" 403 %s :Invalid channel name",
+        c->info->nick ? c->info->nick->name : "*");
     return;
   }
 
-  int empty_slot = -1;
+  Membership *slot = NULL;
   switch(c->status) {
-  case CLIENT_STATUS_OK:
-    for(int i = 0; i < MAX_CHANNELS; i++) {
-      if(!c->channels[i]) {
-        if(empty_slot == -1) empty_slot = i;
-      } else {
-        if(!strcasecmp(m->args[0], c->channels[i])) return;
-      }
+  case CLIENT_STATUS_OK: {
+    Atom *name = atom_intern(channel, len);
+    if(!name) return;
+    if(client_in_channel(c, name)) goto done;
+
+    for(int i = 0; i < MAX_CHANNELS && !slot; i++) {
+      if(!c->info->channels[i].channel) slot = &c->info->channels[i];
     }
 
     // No free slots
-    if(empty_slot == -1) return;
-
-    c->channels[empty_slot] = strdup(m->args[0]);
-    broadcast(NULL, m->args[0],
-        ":%s!%s@%s JOIN %s\r\n",
-        c->nick, c->user, c->host,
-        m->args[0]);
+    if(!slot) goto done;
+
+    if(!channel_join(&shard->channels, name, slot, c)) goto done;
+    char line[MESSAGE_MAX_LEN];
+    MessageBuilder b;
+    client_build(c, &b, line, "JOIN");
+    message_build_param(&b, name->name, name->len);
+    broadcast_str(NULL, name, line, message_build_end(&b));
+  done:
+    atom_release(name);
     break;
+  }
 
   default:
     break;
@@ -249,17 +567,22 @@ void client_part(Client *c, Message *m) {
   if(m->args[0][0] != '#') return;
 
   switch(c->status) {
-  case CLIENT_STATUS_OK:
-    for(int i = 0; i < MAX_CHANNELS; i++) {
-      if(!c->channels[i] || strcasecmp(m->args[0], c->channels[i])) continue;
-      broadcast(NULL, m->args[0],
-          ":%s!%s@%s PART %s\r\n",
-          c->nick, c->user, c->host,
-          m->args[0]);
-      replace(&c->channels[i], NULL);
-      break;
+  case CLIENT_STATUS_OK: {
+    Atom *name = atom_find(m->args[0], m->args_len[0]);
+    if(!name) break;
+
+    Membership *mb = client_membership(c, channel_find(&shard->channels, name));
+    if(mb) {
+      char line[MESSAGE_MAX_LEN];
+      MessageBuilder b;
+      client_build(c, &b, line, "PART");
+      message_build_param(&b, mb->channel->name->name, mb->channel->name->len);
+      broadcast_str(NULL, name, line, message_build_end(&b));
+      channel_leave(&shard->channels, mb);
     }
+    atom_release(name);
     break;
+  }
 
   default:
     break;
@@ -269,105 +592,172 @@ void client_part(Client *c, Message *m) {
 
 
 void client_privmsg(Client *c, Message *m) {
-  static char raw_msg[MESSAGE_MAX_LEN+1];
+  client_message(c, m, "PRIVMSG", true);
+}
 
-  {
-    Message tmp = *m;
-    tmp.prefix.nick = c->nick;
-    tmp.prefix.user = c->user;
-    tmp.prefix.host = c->host;
-    message_tostring(&tmp, raw_msg, MESSAGE_MAX_LEN);
-  }
 
-  switch(c->status) {
-  case CLIENT_STATUS_OK:
-    broadcast(c, m->args[0],
-        ":%s!%s@%s PRIVMSG %s :%s\r\n",
-        c->nick, c->user, c->host,
-        m->args[0], m->args[1]);
-    break;
 
-  default:
-    break;
+void client_notice(Client *c, Message *m) {
+  client_message(c, m, "NOTICE", false);
+}
+
+
+
+// Shared by PRIVMSG and NOTICE. Channel targets go through the channel
+// index; anything else is looked up in the nick registry and delivered
+// straight to that client, wherever its shard is.
+void client_message(Client *c, Message *m, const char *command, bool reply_errors) {
+  if(c->status != CLIENT_STATUS_OK) return;
+
+  char *target = m->args[0];
+  char *buffer = arena_alloc(&shard->arena, MESSAGE_MAX_LEN);
+  if(!buffer) return;
+  MessageBuilder b;
+  client_build(c, &b, buffer, command);
+  message_build_param(&b, target, m->args_len[0]);
+  message_build_trailing(&b, m->args[1], m->args_len[1]);
+  size_t len = message_build_end(&b);
+
+  // A name nobody holds an atom for is neither a channel nor a nick
+  Atom *name = atom_find(target, m->args_len[0]);
+  Client *o = NULL;
+  Shard *sh = NULL;
+  SlabHandle h = 0;
+  if(name && (target[0] == '#' || target[0] == '&')) {
+    broadcast_str(c, name, buffer, len);
+    atom_release(name);
+    return;
+  } else if(name) {
+    pthread_mutex_lock(&nick_lock);
+    o = nick_find(&nicks, name);
+    sh = o ? o->home : NULL;
+    h = o ? o->handle : 0;
+    pthread_mutex_unlock(&nick_lock);
+    atom_release(name);
+  }
+
+  if(o) {
+    deliver(sh, h, buffer, len);
+  } else if(reply_errors) {
+    say(c, ":"SERVER_HOST" 401 %s %s :No such nick/channel", c->info->nick->name, target);
   }
 }
 
 
 
 void client_quit(Client *c, Message *m) {
+  // Unregistered clients have no prefix and nobody to tell
+  if(c->status != CLIENT_STATUS_OK) {
+    c->status = CLIENT_STATUS_CLOSING;
+    return;
+  }
+
+  char line[MESSAGE_MAX_LEN];
+  MessageBuilder b;
+  client_build(c, &b, line, "QUIT");
+  if(m->num_args >= 1) {
+    message_build_trailing(&b, m->args[0], m->args_len[0]);
+  } else {
+    message_build_trailing(&b, "Client disconnected", 19);
+  }
+  size_t len = message_build_end(&b);
+
   for(int i = 0; i < MAX_CHANNELS; i++) {
-    if(!c->channels[i]) continue;
-    broadcast(c, c->channels[i],
-        ":%s!%s@%s QUIT :%s\r\n",
-        c->nick, c->user, c->host,
-        m->num_args >= 1 ? m->args[0] : "Client disconnected");
+    if(!c->info->channels[i].channel) continue;
+    broadcast_str(c, c->info->channels[i].channel->name, line, len);
   }
 
-  say(c, ":%s!%s@%s QUIT :%s",
-        c->nick, c->user, c->host,
-        m->num_args >= 1 ? m->args[0] : "Client disconnected");
-  c->status = CLIENT_STATUS_DISCONNECTED;
+  say_str(c, line, len);
+  c->status = CLIENT_STATUS_CLOSING;
 }
 
 
 
-int read_line(int fd, char *buffer, size_t n) {
-  if(n <= 0 || buffer == NULL) return -1;
+static void stats_reply(void *arg, int numeric, const char *text) {
+  Client *c = arg;
+  say(c, ":"SERVER_HOST" %03d %s %s", numeric, c->info->nick->name, text);
+}
+
 
-  char *cursor = buffer;
-  while(1) {
-    switch(read(fd, cursor, 1)) {
-    case -1:
-      if(errno == EINTR) continue;
-      return -1;
-    case 0:
-      *cursor = '\0';
-      return cursor - buffer;
-    default:
-      switch(*cursor) {
-      case '\n':
-        cursor++;
-        if(cursor - buffer < n) {
-          *cursor = '\0';
-          return cursor - buffer - 1;
-        } else {
-          return -2;
-        }
-      default:
-        cursor++;
-        if(cursor - buffer >= n) return -2;
-      }
-    }
-  }
 
-  return -3; // Unreachable
+void client_stats(Client *c, Message *m) {
+  if(c->status != CLIENT_STATUS_OK) return;
+  stats_report(m->num_args >= 1 ? m->args[0][0] : '*', stats_reply, c);
 }
 
 
 
-void inspect(char *s) {
-  while(*s) {
-    switch(*s) {
-    case '\r': printf("\\r"); break;
-    case '\n': printf("\\n"); break;
-    default: printf("%c", *s);
+// Lines for STATS query m (commands), c (counters) or h (histograms),
+// summed over every shard. '*' reports all of them.
+void stats_report(char query, StatsEmit emit, void *arg) {
+  Metrics *m = malloc(sizeof(Metrics));
+  if(!m) return;
+  metrics_sum(m);
+
+  char text[256];
+  if(query == 'm' || query == '*') {
+    for(size_t i = 0; i < sizeof(client_command_names) / sizeof(client_command_names[0]); i++) {
+      size_t n = 0;
+      for(const char *p = client_command_names[i]; *p; p++) text[n++] = toupper(*p);
+      snprintf(text + n, sizeof(text) - n, " %"PRIu64" 0 0", m->commands[i]);
+      emit(arg, RPL_STATSCOMMANDS, text);
     }
+  }
 
-    s++;
+  if(query == 'c' || query == '*') {
+#define X(n) \
+    snprintf(text, sizeof(text), ":%s %"PRIu64, #n, m->n); \
+    emit(arg, RPL_STATSDEBUG, text);
+    METRICS_COUNTERS
+#undef X
+  }
+
+  if(query == 'h' || query == '*') {
+#define X(n) \
+    snprintf(text, sizeof(text), \
+        ":%s count %"PRIu64" mean %"PRIu64" p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64" max %"PRIu64, \
+        #n, m->n.count, m->n.count ? m->n.sum / m->n.count : 0, \
+        hist_percentile(&m->n, 0.5), hist_percentile(&m->n, 0.9), \
+        hist_percentile(&m->n, 0.99), m->n.max); \
+    emit(arg, RPL_STATSDEBUG, text);
+    METRICS_HISTOGRAMS
+#undef X
   }
-  printf("\n");
+
+  snprintf(text, sizeof(text), "%c :End of STATS report", query);
+  emit(arg, RPL_ENDOFSTATS, text);
+  free(m);
+}
+
+
+
+static void stats_print(void *arg, int numeric, const char *text) {
+  fprintf(stderr, "%s\n", *text == ':' ? text + 1 : text);
+}
+
+
+
+static void stats_signal(int sig) {
+  stats_dump_requested = 1;
+  eventfd_write(shards[0].wake_fd, 1);
 }
 
 
 
 void say_str(Client *c, char *msg, size_t len) {
-  send(c->sock, msg, len, 0);
+  io->send(&c->conn, msg, len);
+}
+
+
+
+void say_shared(Client *c, WireBuf *buf) {
+  io->send_shared(&c->conn, buf);
 }
 
 
 
 void say(Client *c, char *fmt, ...) {
-  static char buffer[MESSAGE_MAX_LEN+1];
+  static _Thread_local char buffer[MESSAGE_MAX_LEN+1];
 
   va_list args;
   va_start(args, fmt);
@@ -381,118 +771,556 @@ void say(Client *c, char *fmt, ...) {
 
 
 void say_message(Client *c, Message *m) {
-  static char buffer[MESSAGE_MAX_LEN+1];
-  message_tostring(m, buffer, MESSAGE_MAX_LEN);
+  static _Thread_local char buffer[MESSAGE_MAX_LEN];
+  size_t len;
+  message_tostring(m, buffer, MESSAGE_MAX_LEN, &len);
+  memcpy(buffer+len, "\r\n", 2);
 
-  say_str(c, buffer, strlen(buffer));
+  say_str(c, buffer, len+2);
 }
 
 
 
-void broadcast_str(Client *except, char *channel, char *msg, size_t len) {
-  for(Client *o = clients; o < clients + MAX_CLIENTS; o++) {
+// Deliver to this shard's members of channel
+void broadcast_local(Client *except, Atom *channel, WireBuf *buf) {
+  Channel *ch = channel_find(&shard->channels, channel);
+  if(!ch) return;
+
+  size_t fanout = 0;
+  for(size_t i = 0; i < ch->num_members; i++) {
+    Client *o = ch->members[i].owner;
     if(o == except || o->status != CLIENT_STATUS_OK) continue;
-    for(char **chan = o->channels; chan < o->channels + MAX_CHANNELS; chan++) {
-      if(!chan) continue;
-      if(!strcasecmp(channel, *chan)) {
-        send(o->sock, msg, len, 0);
-        break;
-      }
+    say_shared(o, buf);
+    fanout++;
+  }
+  hist_record(&metrics.fanout, fanout);
+}
+
+
+
+// Send to one client by handle. Clients on other shards get the message
+// through their shard's inbox, and the handle is checked on arrival in case
+// the client has gone meanwhile.
+void deliver(Shard *sh, SlabHandle target, char *msg, size_t len) {
+  if(sh == shard) {
+    Client *o = slab_get(&shard->clients, CLIENT_COLUMN_HOT, target);
+    if(o && o->status == CLIENT_STATUS_OK) say_str(o, msg, len);
+    return;
+  }
+
+  ShardMsg *sm = malloc(sizeof(ShardMsg) + len);
+  if(!sm) return;
+  sm->channel = NULL;
+  sm->buf = NULL;
+  sm->target = target;
+  sm->len = len;
+  memcpy(sm->msg, msg, len);
+
+  if(mpsc_push(&sh->inbox, &sm->node)) eventfd_write(sh->wake_fd, 1);
+}
+
+
+
+// Deliver locally, then post to every other shard's inbox. The message is
+// copied once into a shared buffer, and every member on every shard queues
+// a reference to it.
+void broadcast_str(Client *except, Atom *channel, char *msg, size_t len) {
+  WireBuf *buf = wirebuf_new(msg, len);
+  if(!buf) return;
+
+  broadcast_local(except, channel, buf);
+
+  for(Shard *sh = shards; sh < shards + num_shards; sh++) {
+    if(sh == shard) continue;
+
+    ShardMsg *sm = malloc(sizeof(ShardMsg));
+    if(!sm) continue;
+    sm->len = 0;
+    sm->target = 0;
+    sm->channel = channel;
+    atom_ref(channel);
+    sm->buf = buf;
+    wirebuf_ref(buf);
+
+    if(mpsc_push(&sh->inbox, &sm->node)) eventfd_write(sh->wake_fd, 1);
+  }
+
+  wirebuf_unref(buf);
+}
+
+
+
+void broadcast_message(Client *except, Atom *channel, Message *m) {
+  static _Thread_local char buffer[MESSAGE_MAX_LEN];
+  size_t len;
+  message_tostring(m, buffer, MESSAGE_MAX_LEN, &len);
+  memcpy(buffer+len, "\r\n", 2);
+
+  broadcast_str(except, channel, buffer, len+2);
+}
+
+
+
+static void restart_signal(int sig) {
+  restart_requested = 1;
+  eventfd_write(shards[0].wake_fd, 1);
+}
+
+
+
+// Drain deliveries posted by other shards
+void shard_drain_inbox(void) {
+  MpscNode *n = mpsc_take(&shard->inbox);
+  while(n) {
+    ShardMsg *sm = (ShardMsg *)n;
+    n = n->next;
+
+    if(sm->channel) {
+      broadcast_local(NULL, sm->channel, sm->buf);
+      atom_release(sm->channel);
+      wirebuf_unref(sm->buf);
+    } else {
+      deliver(shard, sm->target, sm->msg, sm->len);
     }
+    free(sm);
   }
 }
 
 
 
-void broadcast(Client *except, char *channel, char *fmt, ...) {
-  static char buffer[MESSAGE_MAX_LEN+1];
+// Write the clients this shard would hand over, skipping those on their
+// way out. Output is copied as it stands, partly sent line and all; input
+// keeps its partial line and whatever lines a backlog held back.
+void shard_snapshot(void) {
+  SnapWriter *w = &shard->snap;
+  *w = (SnapWriter){};
+  shard->num_snap_fds = 0;
+  shard->snap_fds = malloc((shard->by_fd_cap + 1) * sizeof(int));
+  if(!shard->snap_fds) {
+    w->failed = true;
+    return;
+  }
 
-  va_list args;
-  va_start(args, fmt);
-  int len = vsnprintf(buffer, MESSAGE_MAX_LEN+1, fmt, args);
-  va_end(args);
+  for(size_t fd = 0; fd < shard->by_fd_cap; fd++) {
+    Client *c = shard->by_fd[fd];
+    if(!c || c->status == CLIENT_STATUS_CLOSING || c->conn.closing) continue;
+
+    snap_put_u8(w, c->status);
+    Atom *ids[] = { c->info->nick, c->info->user, c->info->host };
+    for(int i = 0; i < 3; i++) snap_put_str(w, ids[i] ? ids[i]->name : "", ids[i] ? ids[i]->len : 0);
+
+    uint8_t num_channels = 0;
+    for(int i = 0; i < MAX_CHANNELS; i++) num_channels += c->info->channels[i].channel != NULL;
+    snap_put_u8(w, num_channels);
+    for(int i = 0; i < MAX_CHANNELS; i++) {
+      Channel *ch = c->info->channels[i].channel;
+      if(ch) snap_put_str(w, ch->name->name, ch->name->len);
+    }
+
+    LineBuf *in = &c->conn.in;
+    snap_put_str(w, in->data + in->start, in->end - in->start);
+    snap_put_u8(w, in->overflow);
+    char *out = snap_put_blob(w, c->conn.out.bytes);
+    if(out) sendq_copy(&c->conn.out, out);
+
+    shard->snap_fds[shard->num_snap_fds++] = fd;
+  }
+}
+
+
+
+// Start the new process with the original arguments and "-R fd", send it
+// the snapshot and wait for it to take over. It acknowledges once it holds
+// everything, before serving anyone, so on failure this process can carry
+// on as if nothing happened.
+bool hot_restart_handover(void) {
+  SnapWriter w = {};
+  uint32_t num_fds = num_shards;
+  snap_put_u32(&w, num_shards);
+  for(Shard *sh = shards; sh < shards + num_shards; sh++) {
+    if(sh->snap.failed) w.failed = true;
+    snap_put_u32(&w, sh->num_snap_fds);
+    char *p = snap_put_blob(&w, sh->snap.len);
+    if(p && sh->snap.len) memcpy(p, sh->snap.data, sh->snap.len);
+    num_fds += sh->num_snap_fds;
+  }
+
+  int *fds = malloc(num_fds * sizeof(int));
+  int argc = 0;
+  while(server_argv[argc]) argc++;
+  char **argv = malloc((argc + 3) * sizeof(char *));
+  int sv[2] = { -1, -1 };
+  pid_t pid = -1;
+  bool ok = false;
+  if(w.failed || !fds || !argv ||
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+    LOG(LOG_ERROR, "Hot restart: can't prepare the handover");
+    goto done;
+  }
+
+  size_t n = 0;
+  for(Shard *sh = shards; sh < shards + num_shards; sh++) fds[n++] = sh->listen_fd;
+  for(Shard *sh = shards; sh < shards + num_shards; sh++) {
+    memcpy(fds + n, sh->snap_fds, sh->num_snap_fds * sizeof(int));
+    n += sh->num_snap_fds;
+  }
+
+  // Any -R of our own is replaced with the new socket
+  char fd_arg[16];
+  snprintf(fd_arg, sizeof(fd_arg), "%d", sv[1]);
+  int k = 0;
+  for(int i = 0; i < argc; i++) {
+    if(!strcmp(server_argv[i], "-R")) i++;
+    else if(strncmp(server_argv[i], "-R", 2)) argv[k++] = server_argv[i];
+  }
+  argv[k++] = "-R";
+  argv[k++] = fd_arg;
+  argv[k] = NULL;
+
+  pid = fork();
+  if(pid == 0) {
+    fcntl(sv[1], F_SETFD, 0);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  close(sv[1]);
+  if(pid < 0) {
+    LOG(LOG_ERROR, "fork: %s", strerror(errno));
+    goto done;
+  }
+
+  struct timeval timeout = { .tv_sec = RESTART_TIMEOUT_MS / 1000 };
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  char ack;
+  ok = snap_send(sv[0], &w, fds, num_fds) &&
+    poll(&(struct pollfd){ .fd = sv[0], .events = POLLIN }, 1, RESTART_TIMEOUT_MS) == 1 &&
+    read(sv[0], &ack, 1) == 1;
+  if(ok) {
+    LOG(LOG_INFO, "Handed %"PRIu32" clients over to process %d", num_fds - num_shards, (int)pid);
+  } else {
+    LOG(LOG_ERROR, "Hot restart: process %d didn't take over", (int)pid);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+
+done:
+  if(sv[0] >= 0) close(sv[0]);
+  snap_writer_free(&w);
+  free(fds);
+  free(argv);
+  return ok;
+}
+
+
+
+// Run by every shard from its wake handler. The barriers make sure nobody
+// touches a client from the first until the handover is over: once the new
+// process has the sockets, any byte read here would be lost to it.
+void hot_restart_shard(void) {
+  pthread_barrier_wait(&restart_barrier);
+  shard_drain_inbox();
+  shard_snapshot();
+  pthread_barrier_wait(&restart_barrier);
+
+  if(shard == shards) {
+    bool ok = hot_restart_handover();
+    atomic_store(&restarting, false);
+    // The other shards never leave the last barrier
+    if(ok) exit(EXIT_SUCCESS);
+  }
+
+  pthread_barrier_wait(&restart_barrier);
+  snap_writer_free(&shard->snap);
+  free(shard->snap_fds);
+  shard->snap_fds = NULL;
+}
 
-  broadcast_str(except, channel, buffer, len);
+
+
+void shard_wake(void) {
+  if(shard == shards && stats_dump_requested) {
+    stats_dump_requested = 0;
+    stats_report('*', stats_print, NULL);
+  }
+
+  // Ops in flight on an io_uring can't be handed over with the socket
+  if(shard == shards && restart_requested) {
+    restart_requested = 0;
+    if(io != &io_epoll) {
+      LOG(LOG_WARN, "Hot restart needs the epoll backend");
+    } else {
+      atomic_store(&restarting, true);
+      for(Shard *sh = shards + 1; sh < shards + num_shards; sh++) eventfd_write(sh->wake_fd, 1);
+    }
+  }
+
+  if(atomic_load(&restarting)) hot_restart_shard();
+  shard_drain_inbox();
 }
 
 
 
-void broadcast_message(Client *except, char *channel, Message *m) {
-  static char buffer[MESSAGE_MAX_LEN+1];
-  message_tostring(m, buffer, MESSAGE_MAX_LEN);
+// Restore one client from the snapshot, in the order shard_snapshot()
+// wrote it. Returns false if fd is not taken over.
+bool shard_restore_client(SnapReader *r, int fd) {
+  int status = snap_get_u8(r);
+  const char *ids[3];
+  uint32_t ids_len[3];
+  for(int i = 0; i < 3; i++) ids[i] = snap_get_blob(r, &ids_len[i]);
+
+  const char *channels[MAX_CHANNELS];
+  uint32_t channels_len[MAX_CHANNELS];
+  int num_channels = snap_get_u8(r);
+  for(int i = 0; i < num_channels && i < MAX_CHANNELS; i++) {
+    channels[i] = snap_get_blob(r, &channels_len[i]);
+  }
+
+  uint32_t in_len, out_len;
+  const char *in = snap_get_blob(r, &in_len);
+  bool overflow = snap_get_u8(r);
+  const char *out = snap_get_blob(r, &out_len);
+  if(r->failed || num_channels > MAX_CHANNELS || in_len > LINEBUF_SIZE) return false;
+
+  Client *c = client_new(fd);
+  if(!c) return false;
+  c->status = status;
+
+  Atom **atoms[] = { &c->info->nick, &c->info->user, &c->info->host };
+  for(int i = 0; i < 3; i++) {
+    if(ids_len[i] && !(*atoms[i] = atom_intern(ids[i], ids_len[i]))) goto fail;
+  }
+  if(c->info->nick) {
+    pthread_mutex_lock(&nick_lock);
+    bool added = nick_add(&nicks, c->info->nick, c);
+    pthread_mutex_unlock(&nick_lock);
+    if(!added) goto fail;
+  }
+  if(status == CLIENT_STATUS_OK && (!c->info->user || !c->info->host || !client_set_prefix(c))) goto fail;
+
+  for(int i = 0; i < num_channels; i++) {
+    Atom *name = atom_intern(channels[i], channels_len[i]);
+    if(!name) goto fail;
+    Channel *ch = channel_join(&shard->channels, name, &c->info->channels[i], c);
+    atom_release(name);
+    if(!ch) goto fail;
+  }
+
+  linebuf_append(&c->conn.in, in, in_len);
+  c->conn.in.overflow = overflow;
+  if(out_len && !io_queue(&c->conn, out, out_len, NULL)) goto fail;
+  if(io->adopt(&c->conn)) return true;
+
+fail:
+  sendq_clear(&c->conn.out);
+  client_free(c);
+  return false;
+}
+
+
+
+void shard_restore(void) {
+  uint32_t restored = 0;
+  for(uint32_t i = 0; i < shard->num_restore; i++) {
+    int fd = shard->restore_fds[i];
+    if(shard_restore_client(&shard->restore, fd)) restored++;
+    else close(fd);
+  }
+  if(shard->num_restore) {
+    LOG(LOG_INFO, "Restored %"PRIu32" of %"PRIu32" clients", restored, shard->num_restore);
+  }
+}
+
+
+
+void *shard_run(void *arg) {
+  shard = arg;
+  io = io_default;
+  metrics_register();
+
+  if(!slab_init(&shard->clients, 2, (size_t[]){ sizeof(Client), sizeof(ClientInfo) })) {
+    exit(EXIT_FAILURE);
+  }
+
+  if(!io->init(shard->listen_fd, shard->wake_fd, &io_handler)) {
+    if(io == &io_epoll) exit(EXIT_FAILURE);
+    fprintf(stderr, "%s unavailable, falling back to epoll\n", io->name);
+    io = &io_epoll;
+    if(!io->init(shard->listen_fd, shard->wake_fd, &io_handler)) exit(EXIT_FAILURE);
+  }
+
+  // Nobody is served until every shard has its clients and nicks back
+  if(restore_data) {
+    shard_restore();
+    if(pthread_barrier_wait(&restart_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+      free(restore_data);
+      free(restore_fds);
+    }
+  }
 
-  broadcast_str(except, channel, buffer, strlen(buffer));
+  io->run();
+  exit(EXIT_FAILURE);
 }
 
 
 
 #define DIE_IF(cond,msg) if(cond) { perror(msg); exit(errno); }
-int main(int argc, char *argv[]) {
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
+// With several shards every listener sets SO_REUSEPORT and the kernel
+// spreads incoming connections across them
+int server_listen(void) {
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   DIE_IF(sock < 0, "socket");
 
   DIE_IF(
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0,
     "setsockopt");
 
+  if(num_shards > 1) {
+    DIE_IF(
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0,
+      "setsockopt");
+  }
+
   DIE_IF(
     bind(
       sock,
       (struct sockaddr*)&(struct sockaddr_in){
         .sin_family = AF_INET,
-        .sin_port = htons(PORT),
+        .sin_port = htons(port),
         .sin_addr = {.s_addr = INADDR_ANY}
       },
       sizeof(struct sockaddr_in)) != 0,
     "bind");
 
   DIE_IF(
-    listen(sock, 20) != 0,
+    listen(sock, SOMAXCONN) != 0,
     "listen");
 
-  fd_set fdset;
-  FD_ZERO(&fdset);
-  FD_SET(sock, &fdset);
-  while(1) {
-    fd_set read_fdset = fdset;
+  return sock;
+}
 
-    DIE_IF(
-      select(FD_SETSIZE, &read_fdset, NULL, NULL, NULL) < 0,
-      "select");
-
-    for(int i = 0; i < FD_SETSIZE; i++) {
-      if(!FD_ISSET(i, &read_fdset)) continue;
-
-      // Accept new connection
-      if(i == sock) {
-        struct sockaddr_in client_addr;
-        
-        int clientfd = accept(
-            sock,
-            (struct sockaddr*)&client_addr,
-            &(unsigned){0});
-        printf("Accepting new connection on socket %d\n", clientfd);
-        Client *c = client_new();
-        c->sock = clientfd;
-        c->status = CLIENT_STATUS_WAIT_NICK;
-        FD_SET(clientfd, &fdset);
-        continue;
-      }
 
-      // Service existing connection
-      for(int j = 0; j < MAX_CLIENTS; j++) {
-        if(clients[j].status == CLIENT_STATUS_DISCONNECTED || clients[j].sock != i) continue;
-        Client *c = &clients[j];
-        if(client_service(c) < 0 || c->status == CLIENT_STATUS_DISCONNECTED) {
-          FD_CLR(c->sock, &fdset);
-          close(c->sock);
-          client_free(c);
-        }
-        break;
-      }
+
+// Take the listeners and clients from the process that started this one
+// with -R. The shards restore their clients themselves once they run.
+bool hot_restart_receive(int sock) {
+  size_t len;
+  uint32_t num_fds;
+  if(!snap_recv(sock, &restore_data, &len, &restore_fds, &num_fds)) {
+    fprintf(stderr, "Bad hot restart snapshot\n");
+    return false;
+  }
+
+  SnapReader r = { .data = restore_data, .len = len };
+  uint32_t listeners = snap_get_u32(&r);
+  if(listeners != num_shards || num_fds < listeners) {
+    fprintf(stderr, "Hot restart from %"PRIu32" threads needs -t %"PRIu32"\n", listeners, listeners);
+    return false;
+  }
+
+  uint32_t next = listeners;
+  for(int i = 0; i < num_shards; i++) {
+    Shard *sh = &shards[i];
+    sh->listen_fd = restore_fds[i];
+    sh->num_restore = snap_get_u32(&r);
+    uint32_t n;
+    sh->restore.data = snap_get_blob(&r, &n);
+    sh->restore.len = n;
+    sh->restore_fds = restore_fds + next;
+    if(r.failed || num_fds - next < sh->num_restore) {
+      fprintf(stderr, "Bad hot restart snapshot\n");
+      return false;
     }
+    next += sh->num_restore;
   }
 
-  return 0;
+  // The old process stops waiting and exits
+  return write(sock, "", 1) == 1 && close(sock) == 0;
 }
 
+
+
+int main(int argc, char *argv[]) {
+  io_default = &io_epoll;
+  server_argv = argv;
+  int restore_sock = -1;
+
+  int opt;
+  while((opt = getopt(argc, argv, "b:p:t:q:l:R:")) != -1) {
+    switch(opt) {
+    case 'p':
+      port = atoi(optarg);
+      if(port > 0 && port < 65536) break;
+      goto usage;
+
+    case 'b':
+      io_default = io_backend(optarg);
+      if(io_default) break;
+      goto usage;
+
+    case 't':
+      num_shards = atoi(optarg);
+      if(num_shards >= 1 && num_shards <= MAX_SHARDS) break;
+      goto usage;
+
+    case 'q':
+      if(sscanf(optarg, "%zu,%zu", &io_sendq_high, &io_sendq_max) >= 1 &&
+          io_sendq_high > 0 && io_sendq_high <= io_sendq_max) break;
+      goto usage;
+
+    case 'l':
+      log_level = log_level_named(optarg);
+      if(log_level >= 0) break;
+      goto usage;
+
+    // Passed by the previous process on a hot restart
+    case 'R':
+      restore_sock = atoi(optarg);
+      break;
+
+    default:
+      goto usage;
+    }
+  }
+
+  if(!phash_build(&client_command_hash, client_command_names,
+      sizeof(client_command_names) / sizeof(client_command_names[0]))) {
+    fprintf(stderr, "No perfect hash separates COMMANDS\n");
+    return EXIT_FAILURE;
+  }
+
+  shards = calloc(num_shards, sizeof(Shard));
+  DIE_IF(!shards, "calloc");
+
+  errno = pthread_barrier_init(&restart_barrier, NULL, num_shards);
+  DIE_IF(errno, "pthread_barrier_init");
+  if(restore_sock >= 0 && !hot_restart_receive(restore_sock)) return EXIT_FAILURE;
+
+  for(Shard *sh = shards; sh < shards + num_shards; sh++) {
+    if(restore_sock < 0) sh->listen_fd = server_listen();
+    sh->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    DIE_IF(sh->wake_fd < 0, "eventfd");
+  }
+
+  if(!log_start()) {
+    fprintf(stderr, "Can't start the log writer\n");
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction sa = { .sa_handler = stats_signal, .sa_flags = SA_RESTART };
+  sigaction(SIGUSR1, &sa, NULL);
+  sa.sa_handler = restart_signal;
+  sigaction(SIGUSR2, &sa, NULL);
+
+  // The main thread runs the first shard itself
+  for(Shard *sh = shards + 1; sh < shards + num_shards; sh++) {
+    errno = pthread_create(&sh->thread, NULL, shard_run, sh);
+    DIE_IF(errno, "pthread_create");
+  }
+  shard_run(shards);
+  return EXIT_FAILURE;
+
+usage:
+  fprintf(stderr, "Usage: %s [-b epoll|io_uring] [-p port] [-t threads] [-q high[,max]] "
+      "[-l trace|debug|info|warn|error]\n", argv[0]);
+  return EXIT_FAILURE;
+}
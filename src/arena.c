@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "arena.h"
+
+#define ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+
+
+// Make room for size bytes, preferring chunks kept from before the last
+// reset over new ones
+static ArenaChunk *next_chunk(Arena *a, size_t size) {
+  ArenaChunk *next = a->current ? a->current->next : a->first;
+  if(next && next->size >= size) return next;
+
+  size_t n = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+  ArenaChunk *c = malloc(sizeof(ArenaChunk) + n);
+  if(!c) return NULL;
+  a->mallocs++;
+  c->size = n;
+
+  // An unsuitable kept chunk stays after the new one for later
+  c->next = next;
+  if(a->current) a->current->next = c;
+  else a->first = c;
+  return c;
+}
+
+
+
+void *arena_alloc(Arena *a, size_t size) {
+  size = ALIGN(size);
+  if(!a->current || a->current->size - a->used < size) {
+    ArenaChunk *c = next_chunk(a, size);
+    if(!c) return NULL;
+    a->current = c;
+    a->used = 0;
+  }
+
+  void *p = a->current->data + a->used;
+  a->used += size;
+  return p;
+}
+
+
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+  char *p = arena_alloc(a, n + 1);
+  if(!p) return NULL;
+  memcpy(p, s, n);
+  p[n] = 0;
+  return p;
+}
+
+
+
+// Formats straight into the current chunk when the result fits there, so
+// only an overflow costs a second pass
+char *arena_printf(Arena *a, size_t *len, const char *fmt, ...) {
+  size_t room = a->current ? a->current->size - a->used : 0;
+  char *p = a->current ? a->current->data + a->used : NULL;
+
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(p, room, fmt, args);
+  va_end(args);
+  if(n < 0) return NULL;
+
+  if(n < room) {
+    a->used += ALIGN(n + 1);
+  } else {
+    p = arena_alloc(a, n + 1);
+    if(!p) return NULL;
+    va_start(args, fmt);
+    vsnprintf(p, n + 1, fmt, args);
+    va_end(args);
+  }
+
+  if(len) *len = n;
+  return p;
+}
+
+
+
+void arena_reset(Arena *a) {
+  a->current = a->first;
+  a->used = 0;
+}
+
+
+
+void arena_free(Arena *a) {
+  while(a->first) {
+    ArenaChunk *next = a->first->next;
+    free(a->first);
+    a->first = next;
+  }
+  *a = (Arena){};
+}
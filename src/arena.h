@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK 4096
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t size;
+  _Alignas(16) char data[];
+} ArenaChunk;
+
+// Bump allocator for everything that lives only as long as one message.
+// arena_reset() releases it all at once and keeps the chunks for reuse, so
+// once warmed up a steady workload allocates nothing. mallocs counts the
+// chunks taken from malloc, which lets tests check exactly that.
+typedef struct {
+  ArenaChunk *first;
+  ArenaChunk *current;
+  size_t used; // Bytes of current handed out
+  size_t mallocs;
+} Arena;
+
+// Returns 16-byte aligned memory, or NULL if a chunk could not be allocated
+void *arena_alloc(Arena *a, size_t size);
+char *arena_strndup(Arena *a, const char *s, size_t n);
+// Formats into the arena and stores the length, excluding the NUL, in *len
+char *arena_printf(Arena *a, size_t *len, const char *fmt, ...);
+
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
+#endif
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "atom.h"
+#include "message.h"
+
+#define INITIAL_BUCKETS 1024
+
+// Lookups share the lock. Dropping the last reference takes it exclusively,
+// so no lookup can revive an atom that is being freed.
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static Atom **buckets;
+static size_t num_buckets; // Power of two
+static size_t count;
+
+
+
+char atom_fold(char c) {
+  switch(c) {
+  case '[': return '{';
+  case ']': return '}';
+  case '\\': return '|';
+  case '~': return '^';
+  default: return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
+}
+
+
+
+static uint32_t hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+
+// Call with the lock held. Takes a reference on success.
+static Atom *lookup(const char *s, size_t len, uint32_t h) {
+  if(!buckets) return NULL;
+  for(Atom *a = buckets[h & (num_buckets - 1)]; a; a = a->next) {
+    if(a->hash == h && a->len == len && !memcmp(a->name, s, len)) {
+      atomic_fetch_add_explicit(&a->refs, 1, memory_order_relaxed);
+      return a;
+    }
+  }
+  return NULL;
+}
+
+
+
+static void grow(void) {
+  size_t n = num_buckets ? num_buckets * 2 : INITIAL_BUCKETS;
+  Atom **bigger = calloc(n, sizeof(Atom *));
+  if(!bigger) return;
+
+  for(size_t i = 0; i < num_buckets; i++) {
+    Atom *a = buckets[i];
+    while(a) {
+      Atom *next = a->next;
+      a->next = bigger[a->hash & (n - 1)];
+      bigger[a->hash & (n - 1)] = a;
+      a = next;
+    }
+  }
+
+  free(buckets);
+  buckets = bigger;
+  num_buckets = n;
+}
+
+
+
+// Call with the lock held exclusively
+static Atom *insert(const char *s, size_t len, uint32_t h, Atom *key) {
+  if(count >= num_buckets) grow();
+  if(!buckets) return NULL;
+
+  Atom *a = malloc(sizeof(Atom) + len + 1);
+  if(!a) return NULL;
+  a->key = key ? key : a;
+  atomic_init(&a->refs, 1);
+  a->hash = h;
+  a->len = len;
+  memcpy(a->name, s, len);
+  a->name[len] = 0;
+
+  Atom **bucket = &buckets[h & (num_buckets - 1)];
+  a->next = *bucket;
+  *bucket = a;
+  count++;
+  return a;
+}
+
+
+
+static void fold(char *dst, const char *s, size_t len) {
+  for(size_t i = 0; i < len; i++) dst[i] = atom_fold(s[i]);
+}
+
+
+
+// Names come from protocol lines, so none is longer than one
+Atom *atom_intern(const char *s, size_t len) {
+  if(len > MESSAGE_MAX_LEN) return NULL;
+  uint32_t h = hash(s, len);
+
+  pthread_rwlock_rdlock(&lock);
+  Atom *a = lookup(s, len, h);
+  pthread_rwlock_unlock(&lock);
+  if(a) return a;
+
+  char folded[MESSAGE_MAX_LEN];
+  fold(folded, s, len);
+  bool is_key = !memcmp(folded, s, len);
+  Atom *key = is_key ? NULL : atom_intern(folded, len);
+  if(!is_key && !key) return NULL;
+
+  // Someone may have interned it meanwhile
+  pthread_rwlock_wrlock(&lock);
+  a = lookup(s, len, h);
+  if(!a) {
+    a = insert(s, len, h, key);
+    // The new atom keeps the reference on its key
+    if(a) key = NULL;
+  }
+  pthread_rwlock_unlock(&lock);
+
+  if(key) atom_release(key);
+  return a;
+}
+
+
+
+Atom *atom_find(const char *s, size_t len) {
+  if(len > MESSAGE_MAX_LEN) return NULL;
+  char folded[MESSAGE_MAX_LEN];
+  fold(folded, s, len);
+  uint32_t h = hash(folded, len);
+
+  pthread_rwlock_rdlock(&lock);
+  Atom *a = lookup(folded, len, h);
+  pthread_rwlock_unlock(&lock);
+  return a;
+}
+
+
+
+void atom_ref(Atom *a) {
+  atomic_fetch_add_explicit(&a->refs, 1, memory_order_relaxed);
+}
+
+
+
+void atom_release(Atom *a) {
+  size_t refs = atomic_load_explicit(&a->refs, memory_order_relaxed);
+  while(refs > 1) {
+    if(atomic_compare_exchange_weak_explicit(&a->refs, &refs, refs - 1,
+        memory_order_release, memory_order_relaxed)) return;
+  }
+
+  // Possibly the last reference: only drop it with lookups locked out
+  pthread_rwlock_wrlock(&lock);
+  if(atomic_fetch_sub_explicit(&a->refs, 1, memory_order_acq_rel) > 1) {
+    pthread_rwlock_unlock(&lock);
+    return;
+  }
+
+  for(Atom **p = &buckets[a->hash & (num_buckets - 1)]; *p; p = &(*p)->next) {
+    if(*p != a) continue;
+    *p = a->next;
+    break;
+  }
+  count--;
+  pthread_rwlock_unlock(&lock);
+
+  if(a->key != a) atom_release(a->key);
+  free(a);
+}
@@ -0,0 +1,37 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// An interned name. Each spelling is stored once in a global table shared by
+// every thread. key is the atom of the RFC 1459 folded spelling (itself if
+// the name is already folded), so two names are equal ignoring case exactly
+// when their keys are the same pointer, and key->hash hashes them alike.
+typedef struct Atom {
+  struct Atom *key;
+  struct Atom *next; // Hash chain
+  atomic_size_t refs;
+  uint32_t hash;
+  size_t len;
+  char name[];
+} Atom;
+
+// Both return a new reference, or NULL. atom_find() only looks up the
+// folded spelling, for names that are of no use unless something holds them.
+Atom *atom_intern(const char *s, size_t len);
+Atom *atom_find(const char *s, size_t len);
+
+void atom_ref(Atom *a);
+void atom_release(Atom *a);
+
+// RFC 1459 case mapping: {}|^ are the lowercase forms of []\~
+char atom_fold(char c);
+
+static inline bool atom_eq(const Atom *a, const Atom *b) {
+  return a->key == b->key;
+}
+
+#endif
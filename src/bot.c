@@ -0,0 +1,531 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bot.h"
+#include "log.h"
+
+#define SECOND 1000000000ull
+#define MAX_EVENTS 64
+
+
+
+uint64_t bot_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * SECOND + ts.tv_nsec;
+}
+
+
+
+bool bot_init(Bot *bot, const BotConfig *config) {
+  memset(bot, 0, sizeof(*bot));
+  bot->config = *config;
+  BotConfig *c = &bot->config;
+  if(!c->host) c->host = "127.0.0.1";
+  if(!c->port) c->port = 6667;
+  if(!c->user) c->user = c->nick;
+  if(!c->msg_limit) c->msg_limit = 20;
+  if(!c->msg_period) c->msg_period = 30 * SECOND;
+  if(!c->join_limit) c->join_limit = 20;
+  if(!c->join_period) c->join_period = 10 * SECOND;
+  if(!c->join_line) c->join_line = 512;
+
+  bot->fd = -1;
+  bot->backoff = SECOND;
+  linebuf_reset(&bot->in);
+  trigger_init(&bot->triggers, true);
+  if(!bucket_init(&bot->msgs, c->msg_limit, c->msg_period)) return false;
+  if(!bucket_init(&bot->joins, c->join_limit, c->join_period)) {
+    bucket_free(&bot->msgs);
+    return false;
+  }
+  return true;
+}
+
+
+
+void bot_free(Bot *bot) {
+  if(bot->fd >= 0) close(bot->fd);
+  sendq_clear(&bot->out);
+  for(int i = 0; i < BOT_NUM_LANES; i++) free(bot->lanes[i].data);
+  for(size_t i = 0; i < bot->num_channels; i++) free(bot->channels[i]);
+  free(bot->channels);
+  for(size_t i = 0; i < bot->num_handlers; i++) free(bot->handler_names[i]);
+  bucket_free(&bot->msgs);
+  bucket_free(&bot->joins);
+  trigger_free(&bot->triggers);
+  free(bot->trigger_handlers);
+}
+
+
+
+bool bot_on(Bot *bot, const char *command, BotHandler fn, void *arg) {
+  if(bot->num_handlers == BOT_MAX_HANDLERS) return false;
+
+  size_t i = bot->num_handlers;
+  bot->handler_names[i] = strdup(command);
+  if(!bot->handler_names[i]) return false;
+  bot->handlers[i].fn = fn;
+  bot->handlers[i].arg = arg;
+
+  // Handlers are registered up front, so rebuilding is cheap enough
+  if(!phash_build(&bot->handler_hash, (const char *const *)bot->handler_names, i + 1)) {
+    free(bot->handler_names[i]);
+    phash_build(&bot->handler_hash, (const char *const *)bot->handler_names, i);
+    return false;
+  }
+  bot->num_handlers++;
+  return true;
+}
+
+
+
+bool bot_trigger(Bot *bot, int kind, const char *pattern, BotHandler fn, void *arg) {
+  uint32_t n = bot->triggers.num_patterns;
+  if(!(n & (n - 1))) {
+    void *handlers = realloc(bot->trigger_handlers, (n ? n * 2 : 1) * sizeof(*bot->trigger_handlers));
+    if(!handlers) return false;
+    bot->trigger_handlers = handlers;
+  }
+
+  int id = trigger_add(&bot->triggers, kind, pattern, strlen(pattern));
+  if(id < 0) return false;
+  bot->trigger_handlers[id].fn = fn;
+  bot->trigger_handlers[id].arg = arg;
+  bot->triggers_failed = false;
+  return true;
+}
+
+
+
+static void pipeline_emit(void *arg, const char *target, const char *text, size_t len) {
+  bot_privmsg(arg, BOT_LANE_CHAT, target, text);
+}
+
+
+
+void bot_use(Bot *bot, Pipeline *p) {
+  p->emit = pipeline_emit;
+  p->emit_arg = bot;
+  bot->pipeline = p;
+}
+
+
+
+bool bot_join(Bot *bot, const char *channel) {
+  if(bot->num_channels == bot->cap_channels) {
+    size_t cap = bot->cap_channels ? bot->cap_channels * 2 : 64;
+    char **channels = realloc(bot->channels, cap * sizeof(char *));
+    if(!channels) return false;
+    bot->channels = channels;
+    bot->cap_channels = cap;
+  }
+
+  char *name = strdup(channel);
+  if(!name) return false;
+  bot->channels[bot->num_channels++] = name;
+  return true;
+}
+
+
+
+static bool lane_push(BotLane *l, const char *line, size_t len) {
+  size_t need = sizeof(uint16_t) + len + 2;
+  if(len + 2 > MESSAGE_MAX_LEN) return false;
+
+  if(l->tail + need > l->cap) {
+    // Slide what's left to the front before growing
+    memmove(l->data, l->data + l->head, l->tail - l->head);
+    l->tail -= l->head;
+    l->head = 0;
+  }
+  if(l->tail + need > l->cap) {
+    size_t cap = l->cap ? l->cap : 4096;
+    while(cap < l->tail + need) cap *= 2;
+    char *data = realloc(l->data, cap);
+    if(!data) return false;
+    l->data = data;
+    l->cap = cap;
+  }
+
+  uint16_t n = len + 2;
+  memcpy(l->data + l->tail, &n, sizeof(n));
+  memcpy(l->data + l->tail + sizeof(n), line, len);
+  memcpy(l->data + l->tail + sizeof(n) + len, "\r\n", 2);
+  l->tail += need;
+  return true;
+}
+
+
+
+static bool lane_empty(const BotLane *l) {
+  return l->head == l->tail;
+}
+
+
+
+// Move the oldest line of l to the socket queue
+static bool lane_move(Bot *bot, BotLane *l) {
+  uint16_t n;
+  memcpy(&n, l->data + l->head, sizeof(n));
+  if(!sendq_push(&bot->out, l->data + l->head + sizeof(n), n)) return false;
+  l->head += sizeof(n) + n;
+  if(l->head == l->tail) l->head = l->tail = 0;
+  bot->lines_out++;
+  return true;
+}
+
+
+
+bool bot_raw(Bot *bot, int lane, const char *line, size_t len) {
+  return lane_push(&bot->lanes[lane], line, len);
+}
+
+
+
+bool bot_send(Bot *bot, int lane, Message *m) {
+  char line[MESSAGE_MAX_LEN];
+  size_t len;
+  if(!message_tostring(m, line, sizeof(line) - 2, &len)) return false;
+  return bot_raw(bot, lane, line, len);
+}
+
+
+
+bool bot_privmsg(Bot *bot, int lane, const char *target, const char *text) {
+  char line[MESSAGE_MAX_LEN];
+  MessageBuilder b;
+  message_build_init(&b, line, sizeof(line));
+  message_build_command(&b, "PRIVMSG");
+  message_build_param(&b, target, strlen(target));
+  message_build_trailing(&b, text, strlen(text));
+  if(b.overflow) return false;
+  return bot_raw(bot, lane, line, b.len);
+}
+
+
+
+static void watch(Bot *bot, bool out) {
+  if(!bot->loop || bot->writing == out) return;
+  bot->writing = out;
+  struct epoll_event ev = {
+    .events = EPOLLIN | EPOLLRDHUP | (out ? EPOLLOUT : 0),
+    .data.ptr = bot,
+  };
+  epoll_ctl(bot->loop->epfd, EPOLL_CTL_MOD, bot->fd, &ev);
+}
+
+
+
+// Drop the connection. Bots in a loop reconnect after a growing delay and
+// rejoin everything; queued chat is kept, but PONGs would be stale.
+static void disconnect(Bot *bot) {
+  if(bot->fd < 0) return;
+  if(bot->connected) {
+    LOG(LOG_WARN, "%s: disconnected from %s:%d", bot->config.nick, bot->config.host, bot->config.port);
+  } else {
+    LOG(LOG_DEBUG, "%s: could not connect to %s:%d", bot->config.nick, bot->config.host, bot->config.port);
+  }
+
+  close(bot->fd);
+  bot->fd = -1;
+  bot->connected = bot->registered = bot->writing = false;
+  bot->join_next = 0;
+  sendq_clear(&bot->out);
+  linebuf_reset(&bot->in);
+  bot->lanes[BOT_LANE_URGENT].head = bot->lanes[BOT_LANE_URGENT].tail = 0;
+
+  bot->reconnect_at = bot_now() + bot->backoff;
+  bot->backoff = bot->backoff * 2 < BOT_BACKOFF_MAX ? bot->backoff * 2 : BOT_BACKOFF_MAX;
+}
+
+
+
+static void flush(Bot *bot) {
+  while(bot->out.bytes > 0) {
+    struct msghdr msg = { .msg_iov = bot->iov };
+    msg.msg_iovlen = sendq_iov(&bot->out, bot->iov, SENDQ_IOV);
+    ssize_t sent = sendmsg(bot->fd, &msg, MSG_NOSIGNAL);
+    if(sent < 0) {
+      if(errno == EINTR) continue;
+      if(errno != EAGAIN && errno != EWOULDBLOCK) disconnect(bot);
+      break;
+    }
+    sendq_consume(&bot->out, sent);
+  }
+  if(bot->fd >= 0) watch(bot, bot->out.bytes > 0);
+}
+
+
+
+static void register_(Bot *bot) {
+  char line[MESSAGE_MAX_LEN];
+  int n = 0;
+  if(bot->config.pass) n += snprintf(line, sizeof(line), "PASS %s\r\n", bot->config.pass);
+  n += snprintf(line + n, sizeof(line) - n, "NICK %s\r\nUSER %s 0 * :%s\r\n",
+      bot->config.nick, bot->config.user, bot->config.nick);
+  if(n < sizeof(line)) sendq_push(&bot->out, line, n);
+  bot->connected = true;
+}
+
+
+
+bool bot_attach(Bot *bot, int fd) {
+  if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) return false;
+  bot->fd = fd;
+  register_(bot);
+  flush(bot);
+  return bot->fd >= 0;
+}
+
+
+
+// Build the automaton on first use, without retrying a failed build per line
+static bool triggers_ready(Bot *bot) {
+  if(bot->triggers.built) return true;
+  if(bot->triggers_failed) return false;
+  if(trigger_build(&bot->triggers)) return true;
+  LOG(LOG_ERROR, "%s: out of memory building triggers", bot->config.nick);
+  bot->triggers_failed = true;
+  return false;
+}
+
+
+
+static void on_line(Bot *bot, char *line, size_t len) {
+  Message m;
+  if(!message_parse(&m, line, len)) return;
+  bot->lines_in++;
+
+  if(!strcmp(m.command, "PING")) {
+    char pong[MESSAGE_MAX_LEN];
+    MessageBuilder b;
+    message_build_init(&b, pong, sizeof(pong));
+    message_build_command(&b, "PONG");
+    if(m.num_args) message_build_trailing(&b, m.args[0], m.args_len[0]);
+    // A cut token would answer some other PING
+    if(!b.overflow) bot_raw(bot, BOT_LANE_URGENT, pong, b.len);
+  } else if(!strcmp(m.command, "001")) {
+    bot->registered = true;
+    bot->backoff = SECOND;
+  }
+
+  if(bot->num_handlers) {
+    int i = phash_find(&bot->handler_hash, m.command, m.command_len);
+    if(i >= 0) bot->handlers[i].fn(bot, &m, bot->handlers[i].arg);
+  }
+
+  // If the automaton can't be built, the message still goes to the pipeline
+  if(bot->triggers.num_patterns && !strcmp(m.command, "PRIVMSG") && m.num_args == 2 &&
+      triggers_ready(bot)) {
+    uint32_t ids[BOT_MAX_TRIGGERED];
+    size_t n = trigger_scan(&bot->triggers, m.args[1], m.args_len[1], ids, BOT_MAX_TRIGGERED);
+    for(size_t i = 0; i < n; i++) {
+      bot->trigger_handlers[ids[i]].fn(bot, &m, bot->trigger_handlers[ids[i]].arg);
+    }
+  }
+  if(bot->pipeline) pipeline_push(bot->pipeline, &m, bot_now());
+}
+
+
+
+void bot_input(Bot *bot) {
+  ssize_t n;
+  while(bot->fd >= 0 && (n = linebuf_read(&bot->in, bot->fd)) > 0) {
+    char *line;
+    size_t len;
+    while(bot->fd >= 0 && (line = linebuf_next(&bot->in, &len))) on_line(bot, line, len);
+    // Lines stay put until the next read
+    if(bot->pipeline) pipeline_flush(bot->pipeline, bot_now());
+  }
+  if(bot->fd >= 0 && (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))) disconnect(bot);
+}
+
+
+
+static void wake_at(uint64_t *wake, uint64_t t) {
+  if(!*wake || t < *wake) *wake = t;
+}
+
+
+
+// Batch as many pending channels into one JOIN as the limit and line
+// length allow, but always at least one
+static bool send_joins(Bot *bot, unsigned allowed, uint64_t now) {
+  char line[MESSAGE_MAX_LEN];
+  size_t max = bot->config.join_line < sizeof(line) ? bot->config.join_line : sizeof(line);
+  size_t len = 0;
+  unsigned n = 0;
+
+  memcpy(line, "JOIN ", 5);
+  len = 5;
+  while(n < allowed && bot->join_next < bot->num_channels) {
+    const char *name = bot->channels[bot->join_next];
+    size_t name_len = strlen(name);
+    if(len + (n > 0) + name_len + 2 > max && n > 0) break;
+    if(len + (n > 0) + name_len + 2 > sizeof(line)) {
+      bot->join_next++; // Can never be sent
+      continue;
+    }
+    if(n > 0) line[len++] = ',';
+    memcpy(line + len, name, name_len);
+    len += name_len;
+    bot->join_next++;
+    n++;
+  }
+  if(!n) return false;
+
+  memcpy(line + len, "\r\n", 2);
+  bucket_take(&bot->joins, n, now);
+  bot->lines_out++;
+  return sendq_push(&bot->out, line, len + 2);
+}
+
+
+
+// Move one line to the socket queue if any may go now
+static bool next_line(Bot *bot, uint64_t now, uint64_t *wake) {
+  BotLane *urgent = &bot->lanes[BOT_LANE_URGENT];
+  if(!lane_empty(urgent)) return lane_move(bot, urgent);
+  if(!bot->registered) return false;
+
+  for(int i = BOT_LANE_URGENT + 1; i < BOT_NUM_LANES; i++) {
+    BotLane *l = &bot->lanes[i];
+    if(lane_empty(l)) continue;
+    if(bucket_available(&bot->msgs, now) == 0) {
+      wake_at(wake, bucket_ready_at(&bot->msgs, 1));
+      break;
+    }
+    bucket_take(&bot->msgs, 1, now);
+    return lane_move(bot, l);
+  }
+
+  if(bot->join_next < bot->num_channels) {
+    unsigned allowed = bucket_available(&bot->joins, now);
+    if(allowed) return send_joins(bot, allowed, now);
+    wake_at(wake, bucket_ready_at(&bot->joins, 1));
+  }
+  return false;
+}
+
+
+
+uint64_t bot_pump(Bot *bot, uint64_t now) {
+  uint64_t wake = 0;
+  if(!bot->connected) return 0;
+  while(bot->out.bytes < BOT_OUT_HIGH && next_line(bot, now, &wake));
+  flush(bot);
+  return wake;
+}
+
+
+
+bool bot_loop_init(BotLoop *loop) {
+  memset(loop, 0, sizeof(*loop));
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  return loop->epfd >= 0;
+}
+
+
+
+bool bot_loop_add(BotLoop *loop, Bot *bot) {
+  if(loop->num_bots == loop->cap_bots) {
+    size_t cap = loop->cap_bots ? loop->cap_bots * 2 : 16;
+    Bot **bots = realloc(loop->bots, cap * sizeof(Bot *));
+    if(!bots) return false;
+    loop->bots = bots;
+    loop->cap_bots = cap;
+  }
+  loop->bots[loop->num_bots++] = bot;
+  bot->loop = loop;
+  return true;
+}
+
+
+
+static void start_connect(Bot *bot) {
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(bot->config.port),
+  };
+  if(inet_pton(AF_INET, bot->config.host, &addr.sin_addr) != 1) {
+    LOG(LOG_ERROR, "%s: bad address %s", bot->config.nick, bot->config.host);
+    bot->reconnect_at = bot_now() + BOT_BACKOFF_MAX;
+    return;
+  }
+
+  bot->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(bot->fd < 0) {
+    bot->reconnect_at = bot_now() + bot->backoff;
+    return;
+  }
+  setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP, .data.ptr = bot };
+  bot->writing = true;
+  if((connect(bot->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) ||
+      epoll_ctl(bot->loop->epfd, EPOLL_CTL_ADD, bot->fd, &ev) != 0) {
+    disconnect(bot);
+  }
+}
+
+
+
+// The socket became writable; the first time, that means connect finished
+static void on_writable(Bot *bot) {
+  if(bot->connected) {
+    flush(bot);
+    return;
+  }
+
+  int err = 0;
+  getsockopt(bot->fd, SOL_SOCKET, SO_ERROR, &err, &(socklen_t){sizeof(err)});
+  if(err) {
+    disconnect(bot);
+    return;
+  }
+  LOG(LOG_INFO, "%s: connected to %s:%d", bot->config.nick, bot->config.host, bot->config.port);
+  register_(bot);
+  flush(bot);
+}
+
+
+
+void bot_loop_run(BotLoop *loop, int timeout_ms) {
+  uint64_t now = bot_now();
+  uint64_t wake = now + timeout_ms * 1000000ull;
+
+  for(size_t i = 0; i < loop->num_bots; i++) {
+    Bot *bot = loop->bots[i];
+    if(bot->fd < 0 && now >= bot->reconnect_at) start_connect(bot);
+    if(bot->fd < 0) {
+      wake_at(&wake, bot->reconnect_at);
+      continue;
+    }
+    uint64_t t = bot_pump(bot, now);
+    if(t) wake_at(&wake, t);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  int timeout = wake > now ? (wake - now + 999999) / 1000000 : 0;
+  int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+  for(int i = 0; i < n; i++) {
+    Bot *bot = events[i].data.ptr;
+    if(bot->fd >= 0 && events[i].events & (EPOLLOUT | EPOLLERR)) on_writable(bot);
+    if(bot->fd >= 0 && bot->connected && events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+      bot_input(bot);
+    }
+    // Answer what came in, PONGs especially, without waiting a round
+    if(bot->fd >= 0) bot_pump(bot, bot_now());
+  }
+}
@@ -0,0 +1,162 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "linebuf.h"
+#include "message.h"
+#include "phash.h"
+#include "pipeline.h"
+#include "ratelimit.h"
+#include "sendq.h"
+#include "trigger.h"
+
+// Client runtime for bots. Each Bot is one server connection with its own
+// command handlers and rate-limited outbound lanes; a BotLoop drives any
+// number of them from one thread, connecting and reconnecting as needed.
+//
+// Outbound lines wait in lanes and are moved to the socket's queue in
+// priority order, as their limits allow. Only a little is moved at a time,
+// so urgent lines queued later still overtake chat waiting for the socket.
+
+// Lanes, highest priority first. URGENT (PONG and the like) is never rate
+// limited. CONTROL (moderation) and CHAT share the message limit, and
+// CONTROL always goes first.
+#define BOT_LANES \
+X(URGENT) \
+X(CONTROL) \
+X(CHAT)
+
+enum {
+#define X(l) BOT_LANE_##l,
+BOT_LANES
+#undef X
+  BOT_NUM_LANES
+};
+
+#define BOT_MAX_HANDLERS 32
+#define BOT_MAX_TRIGGERED 32 // Triggers run per message
+#define BOT_OUT_HIGH 16384 // Bytes queued for the socket before lanes wait
+#define BOT_BACKOFF_MAX 60000000000ull
+
+typedef struct Bot Bot;
+typedef void (*BotHandler)(Bot *bot, Message *m, void *arg);
+
+// Zero fields take the defaults noted
+typedef struct {
+  const char *host;     // IPv4 address, 127.0.0.1
+  int port;             // 6667
+  const char *nick;
+  const char *user;     // nick
+  const char *pass;     // Sent as PASS if set
+  unsigned msg_limit;   // PRIVMSGs and the like per msg_period, 20
+  uint64_t msg_period;  // 30 s
+  unsigned join_limit;  // Channels joined per join_period, 20
+  uint64_t join_period; // 10 s
+  size_t join_line;     // Longest batched JOIN line, 512
+} BotConfig;
+
+// Lines waiting in one lane, each stored as a 16-bit length and its bytes
+typedef struct {
+  char *data;
+  size_t head;
+  size_t tail;
+  size_t cap;
+} BotLane;
+
+struct Bot {
+  BotConfig config;
+  int fd;
+  bool connected;  // Connection established
+  bool registered; // The server sent 001
+  bool writing;    // Waiting for the socket to take more
+  uint64_t reconnect_at;
+  uint64_t backoff;
+
+  LineBuf in;
+  SendQ out;
+  struct iovec iov[SENDQ_IOV];
+  BotLane lanes[BOT_NUM_LANES];
+  TokenBucket msgs;
+  TokenBucket joins;
+
+  // Every channel asked for. Those from join_next on are still to be sent,
+  // and a new connection starts again from 0.
+  char **channels;
+  size_t num_channels;
+  size_t cap_channels;
+  size_t join_next;
+
+  char *handler_names[BOT_MAX_HANDLERS];
+  struct {
+    BotHandler fn;
+    void *arg;
+  } handlers[BOT_MAX_HANDLERS];
+  size_t num_handlers;
+  PHash handler_hash;
+  Pipeline *pipeline;
+
+  TriggerSet triggers;
+  struct {
+    BotHandler fn;
+    void *arg;
+  } *trigger_handlers; // By trigger id
+  bool triggers_failed; // Building ran out of memory; tried again once a trigger is added
+
+  uint64_t lines_in;
+  uint64_t lines_out;
+  struct BotLoop *loop;
+};
+
+bool bot_init(Bot *bot, const BotConfig *config);
+void bot_free(Bot *bot);
+
+// Call fn for every received command, e.g. "PRIVMSG" or "001". PING and 001
+// are also handled by the runtime itself.
+bool bot_on(Bot *bot, const char *command, BotHandler fn, void *arg);
+
+// Call fn for every PRIVMSG whose text matches pattern, a TRIGGER_* kind.
+// Every trigger is matched in one pass over the text, ignoring case.
+bool bot_trigger(Bot *bot, int kind, const char *pattern, BotHandler fn, void *arg);
+
+// Also run every received message through p, a batch per read. Replies go
+// out on the CHAT lane.
+void bot_use(Bot *bot, Pipeline *p);
+
+// Joins are batched into comma-separated JOIN lines under the join limit
+bool bot_join(Bot *bot, const char *channel);
+
+// Queue a line, without its "\r\n". Returns false if it is too long or
+// memory ran out.
+bool bot_raw(Bot *bot, int lane, const char *line, size_t len);
+bool bot_send(Bot *bot, int lane, Message *m);
+bool bot_privmsg(Bot *bot, int lane, const char *target, const char *text);
+
+// Use fd, already connected, and register on it. BotLoop does this itself.
+bool bot_attach(Bot *bot, int fd);
+
+// Handle everything readable on the connection
+void bot_input(Bot *bot);
+
+// Move what the limits allow to the socket and write it. Returns when the
+// bot next needs to run for its limits, or 0 if nothing is waiting on them.
+uint64_t bot_pump(Bot *bot, uint64_t now);
+
+uint64_t bot_now(void);
+
+typedef struct BotLoop {
+  int epfd;
+  Bot **bots;
+  size_t num_bots;
+  size_t cap_bots;
+} BotLoop;
+
+bool bot_loop_init(BotLoop *loop);
+bool bot_loop_add(BotLoop *loop, Bot *bot);
+
+// Connect, read, write and wait for limits for up to timeout_ms
+void bot_loop_run(BotLoop *loop, int timeout_ms);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include "channel.h"
+
+#define INITIAL_BUCKETS 64
+#define INITIAL_MEMBERS 4
+
+
+
+#define BUCKET(t,name) ((t)->buckets[(name)->key->hash & ((t)->num_buckets - 1)])
+
+
+
+Channel *channel_find(ChannelTable *t, const Atom *name) {
+  if(!t->buckets) return NULL;
+
+  for(Channel *ch = BUCKET(t, name); ch; ch = ch->next) {
+    if(atom_eq(ch->name, name)) return ch;
+  }
+  return NULL;
+}
+
+
+
+static void grow(ChannelTable *t) {
+  size_t n = t->num_buckets ? t->num_buckets * 2 : INITIAL_BUCKETS;
+  Channel **buckets = calloc(n, sizeof(Channel *));
+  if(!buckets) return;
+
+  for(size_t i = 0; i < t->num_buckets; i++) {
+    Channel *ch = t->buckets[i];
+    while(ch) {
+      Channel *next = ch->next;
+      uint32_t h = ch->name->key->hash;
+      ch->next = buckets[h & (n - 1)];
+      buckets[h & (n - 1)] = ch;
+      ch = next;
+    }
+  }
+
+  free(t->buckets);
+  t->buckets = buckets;
+  t->num_buckets = n;
+}
+
+
+
+static Channel *create(ChannelTable *t, Atom *name) {
+  if(t->count >= t->num_buckets) grow(t);
+  if(!t->buckets) return NULL;
+
+  Channel *ch = calloc(1, sizeof(Channel));
+  if(!ch) return NULL;
+  ch->name = name;
+  atom_ref(name);
+
+  Channel **bucket = &BUCKET(t, name);
+  ch->next = *bucket;
+  *bucket = ch;
+  t->count++;
+  return ch;
+}
+
+
+
+static void destroy(ChannelTable *t, Channel *ch) {
+  for(Channel **p = &BUCKET(t, ch->name); *p; p = &(*p)->next) {
+    if(*p != ch) continue;
+    *p = ch->next;
+    break;
+  }
+
+  t->count--;
+  free(ch->members);
+  atom_release(ch->name);
+  free(ch);
+}
+
+
+
+// Add mb to the channel called name, creating the channel if needed
+Channel *channel_join(ChannelTable *t, Atom *name, Membership *mb, void *owner) {
+  Channel *ch = channel_find(t, name);
+  if(!ch) ch = create(t, name);
+  if(!ch) return NULL;
+
+  if(ch->num_members == ch->cap_members) {
+    size_t cap = ch->cap_members ? ch->cap_members * 2 : INITIAL_MEMBERS;
+    ChannelMember *members = realloc(ch->members, cap * sizeof(ChannelMember));
+    if(!members) {
+      if(!ch->num_members) destroy(t, ch);
+      return NULL;
+    }
+    ch->members = members;
+    ch->cap_members = cap;
+  }
+
+  mb->channel = ch;
+  mb->index = ch->num_members;
+  ch->members[ch->num_members++] = (ChannelMember){ .owner = owner, .mb = mb };
+  return ch;
+}
+
+
+
+// Swap-remove mb from its channel and clear it
+void channel_leave(ChannelTable *t, Membership *mb) {
+  Channel *ch = mb->channel;
+  if(!ch) return;
+
+  ChannelMember last = ch->members[--ch->num_members];
+  ch->members[mb->index] = last;
+  last.mb->index = mb->index;
+
+  *mb = (Membership){};
+  if(!ch->num_members) destroy(t, ch);
+}
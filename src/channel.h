@@ -0,0 +1,45 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stddef.h>
+#include "atom.h"
+
+typedef struct Channel Channel;
+
+// One member's side of a channel membership. The owner embeds these and the
+// channel keeps pointers to them, so leaving is O(1) in both directions.
+typedef struct {
+  Channel *channel;
+  size_t index; // Position in channel->members
+} Membership;
+
+// Delivery only needs owner, so it sits beside the back-reference rather
+// than behind it
+typedef struct {
+  void *owner;
+  Membership *mb;
+} ChannelMember;
+
+struct Channel {
+  Atom *name; // As spelled by whoever created it; holds a reference
+  Channel *next; // Hash chain
+
+  ChannelMember *members;
+  size_t num_members;
+  size_t cap_members;
+};
+
+// Case-insensitive map of channel name to Channel, compared by atom key.
+// Channels are created on first join and destroyed when their last member
+// leaves.
+typedef struct {
+  Channel **buckets;
+  size_t num_buckets; // Power of two
+  size_t count;
+} ChannelTable;
+
+Channel *channel_find(ChannelTable *t, const Atom *name);
+Channel *channel_join(ChannelTable *t, Atom *name, Membership *mb, void *owner);
+void channel_leave(ChannelTable *t, Membership *mb);
+
+#endif
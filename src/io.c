@@ -0,0 +1,62 @@
+#include <string.h>
+#include <sys/socket.h>
+#include "io.h"
+#include "metrics.h"
+#include "log.h"
+
+size_t io_sendq_high = 64 * 1024;
+size_t io_sendq_max = 1024 * 1024;
+
+static IoBackend *backends[] = {
+#define X(b,...) &io_##b,
+IO_BACKENDS
+#undef X
+};
+
+
+
+IoBackend *io_backend(const char *name) {
+  for(int i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    if(!strcmp(backends[i]->name, name)) return backends[i];
+  }
+  return NULL;
+}
+
+
+
+bool io_queue(Conn *c, const char *msg, size_t len, WireBuf *shared) {
+  if(shared) len = shared->len;
+
+  // Shutting the socket down fails any send in flight, so the queue can be
+  // dropped as soon as the backend gets it back
+  if(c->out.bytes + len > io_sendq_max) {
+    LOG(LOG_WARN, "Send queue exceeded on socket %d", c->fd);
+    metric_add(&metrics.slow_consumers, 1);
+    shutdown(c->fd, SHUT_RDWR);
+    return false;
+  }
+
+  if(!c->out.bytes) c->queued_at = metrics_now();
+  metric_add(&metrics.lines_out, 1);
+  metric_add(&metrics.bytes_out, len);
+  return shared ? sendq_push_shared(&c->out, shared) : sendq_push(&c->out, msg, len);
+}
+
+
+
+void io_sent(Conn *c, size_t n) {
+  sendq_consume(&c->out, n);
+  if(!c->out.bytes) hist_record(&metrics.flush_ns, metrics_now() - c->queued_at);
+}
+
+
+
+bool io_backlogged(Conn *c) {
+  return c->out.bytes > io_sendq_high;
+}
+
+
+
+bool io_drained(Conn *c) {
+  return c->out.bytes <= io_sendq_high / 2;
+}
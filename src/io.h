@@ -0,0 +1,94 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "linebuf.h"
+#include "sendq.h"
+
+// Per-connection state shared by every I/O backend. The server embeds one
+// at the start of each of its connection objects.
+typedef struct Conn {
+  int fd;
+  LineBuf in;
+
+  // Output waiting for the socket, and the writev describing the send in
+  // flight for backends that send asynchronously
+  SendQ out;
+  uint64_t queued_at; // When out last went from empty to not
+  struct iovec iov[SENDQ_IOV];
+  struct msghdr msg;
+
+  // Input received after the connection was paused, for backends that
+  // cannot leave it in the socket
+  char *held;
+  size_t held_len;
+
+  int inflight;
+  bool receiving;
+  bool sending;
+  bool paused;
+  bool closing;
+  bool queued;
+  struct Conn *next_queued;
+} Conn;
+
+// Callbacks from the backend into the server
+typedef struct {
+  // A connection was accepted. Return its Conn, or NULL to refuse it.
+  Conn *(*accept)(int fd);
+  // conn->in has new bytes. Return < 0 to close the connection. Lines may
+  // be left in conn->in once the connection is backlogged; they are offered
+  // again when it drains.
+  int (*input)(Conn *conn);
+  // The connection is closed and no operation refers to it any more
+  void (*release)(Conn *conn);
+  // The wake fd was signalled
+  void (*wake)(void);
+} IoHandler;
+
+// Backend state is thread-local: each thread that calls init() and run()
+// drives its own listener and connections.
+typedef struct {
+  const char *name;
+  bool (*init)(int listen_fd, int wake_fd, IoHandler *handler);
+  void (*run)(void);
+  void (*send)(Conn *conn, const char *msg, size_t len);
+  // Queue a reference to buf; the caller keeps its own
+  void (*send_shared)(Conn *conn, WireBuf *buf);
+  // Take over an open connection, such as one handed over by a previous
+  // process, whose buffers may already hold input and output. Returns false
+  // if it cannot be registered; the caller still owns it then.
+  bool (*adopt)(Conn *conn);
+} IoBackend;
+
+#define IO_BACKENDS \
+X(epoll) \
+X(uring)
+
+#define X(b,...) extern IoBackend io_##b;
+IO_BACKENDS
+#undef X
+
+IoBackend *io_backend(const char *name);
+
+// Output limits, shared by every backend and set before any of them runs.
+// A connection with more than io_sendq_high bytes queued stops reading input
+// until it drains to half that. One that would exceed io_sendq_max is
+// disconnected as a slow consumer.
+extern size_t io_sendq_high;
+extern size_t io_sendq_max;
+
+// Queue output for c, copying msg unless shared is given. Returns false if
+// c must be closed because it fell too far behind or memory ran out.
+bool io_queue(Conn *c, const char *msg, size_t len, WireBuf *shared);
+
+// n bytes of c's queue reached the socket
+void io_sent(Conn *c, size_t n);
+
+bool io_backlogged(Conn *c);
+bool io_drained(Conn *c);
+
+#endif
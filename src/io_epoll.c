@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "io.h"
+#include "log.h"
+
+#define MAX_EVENTS 256
+
+static _Thread_local int epfd = -1;
+static _Thread_local int listen_fd = -1;
+static _Thread_local int wake_fd = -1;
+static _Thread_local IoHandler *handler;
+
+// Connections with output to flush or a close to finish once the current
+// batch of events has been handled
+static _Thread_local Conn *queued;
+
+// Tags the wake fd registration; the listener is tagged with NULL
+static char wake_tag;
+
+
+
+static bool init(int fd, int wfd, IoHandler *h) {
+  listen_fd = fd;
+  wake_fd = wfd;
+  handler = h;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd < 0) {
+    perror("epoll_create1");
+    return false;
+  }
+
+  // The listener is the only registration without a Conn behind it
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+  struct epoll_event wake_ev = { .events = EPOLLIN | EPOLLET, .data.ptr = &wake_tag };
+  if(epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0 ||
+      epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &wake_ev) < 0) {
+    perror("epoll_ctl");
+    close(epfd);
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// Accept everything in the backlog. The listener is edge-triggered, so stop
+// only once accept4 runs dry.
+static void accept_all(void) {
+  while(1) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      if(errno != EAGAIN && errno != EWOULDBLOCK) LOG(LOG_ERROR, "accept4: %s", strerror(errno));
+      return;
+    }
+    // Output is already coalesced into one writev per batch; Nagle would
+    // only hold it back waiting for the client's delayed ACK
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+    Conn *c = handler->accept(fd);
+    if(!c) {
+      close(fd);
+      continue;
+    }
+
+    struct epoll_event ev = {
+      .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+      .data.ptr = c
+    };
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      LOG(LOG_ERROR, "epoll_ctl: %s", strerror(errno));
+      close(fd);
+      handler->release(c);
+    }
+  }
+}
+
+
+
+static void enqueue(Conn *c) {
+  if(c->queued) return;
+  c->queued = true;
+  c->next_queued = queued;
+  queued = c;
+}
+
+
+
+// The fd is only closed once the batch is over, so no other event in it
+// can refer to a released connection
+static void start_close(Conn *c) {
+  if(c->closing) return;
+  c->closing = true;
+  enqueue(c);
+}
+
+
+
+static void service(Conn *c);
+
+// Write as much queued output as the socket takes, and resume reading once
+// a paused connection has drained
+static void flush(Conn *c) {
+  while(c->out.bytes > 0) {
+    c->msg.msg_iov = c->iov;
+    c->msg.msg_iovlen = sendq_iov(&c->out, c->iov, SENDQ_IOV);
+    ssize_t n = sendmsg(c->fd, &c->msg, MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      if(errno != EAGAIN && errno != EWOULDBLOCK) start_close(c);
+      break;
+    }
+    io_sent(c, n);
+  }
+
+  if(c->paused && !c->closing && io_drained(c)) {
+    c->paused = false;
+    if(handler->input(c) < 0) start_close(c);
+    else service(c);
+  }
+}
+
+
+
+// Drain the socket until EAGAIN, as edge triggering requires, unless the
+// connection has too much output queued. Then the rest stays in the socket
+// until it drains.
+static void service(Conn *c) {
+  while(!c->closing) {
+    if(io_backlogged(c)) {
+      c->paused = true;
+      return;
+    }
+
+    ssize_t n = linebuf_read(&c->in, c->fd);
+    if(n > 0) {
+      if(handler->input(c) < 0) start_close(c);
+      continue;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    start_close(c);
+  }
+}
+
+
+
+static void flush_queued(void) {
+  while(queued) {
+    Conn *c = queued;
+    queued = c->next_queued;
+    c->queued = false;
+
+    bool closing = c->closing;
+    flush(c);
+    if(closing) {
+      close(c->fd);
+      sendq_clear(&c->out);
+      handler->release(c);
+    }
+  }
+}
+
+
+
+static void run(void) {
+  struct epoll_event events[MAX_EVENTS];
+
+  while(1) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      perror("epoll_wait");
+      return;
+    }
+
+    for(int i = 0; i < n; i++) {
+      Conn *c = events[i].data.ptr;
+      if(c == (Conn *)&wake_tag) {
+        eventfd_t value;
+        eventfd_read(wake_fd, &value);
+        handler->wake();
+      } else if(c) {
+        if(c->closing) continue;
+        if(events[i].events & EPOLLOUT) flush(c);
+        if(events[i].events & ~EPOLLOUT && !c->paused) service(c);
+      } else {
+        accept_all();
+      }
+    }
+
+    flush_queued();
+  }
+}
+
+
+
+// Output is only queued here and written once per batch of events, so
+// everything sent to a connection in one batch goes out in one writev
+static void send_(Conn *c, const char *msg, size_t len) {
+  if(c->closing) return;
+  if(io_queue(c, msg, len, NULL)) enqueue(c);
+  else start_close(c);
+}
+
+
+
+static void send_shared(Conn *c, WireBuf *buf) {
+  if(c->closing) return;
+  if(io_queue(c, NULL, 0, buf)) enqueue(c);
+  else start_close(c);
+}
+
+
+
+// The registration reports whatever is already readable, so only lines
+// carried over in the buffer need handling here
+static bool adopt(Conn *c) {
+  struct epoll_event ev = {
+    .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+    .data.ptr = c
+  };
+  if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+    LOG(LOG_ERROR, "epoll_ctl: %s", strerror(errno));
+    return false;
+  }
+
+  if(handler->input(c) < 0) start_close(c);
+  else if(io_backlogged(c)) c->paused = true;
+  enqueue(c);
+  return true;
+}
+
+
+
+IoBackend io_epoll = {
+  .name = "epoll",
+  .init = init,
+  .run = run,
+  .send = send_,
+  .send_shared = send_shared,
+  .adopt = adopt,
+};
@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include "io.h"
+#include "log.h"
+
+// io_uring backend. One multishot accept feeds new connections, each
+// connection keeps one multishot recv armed that draws from a ring of
+// provided buffers, and sends queued while handling a batch of completions
+// are submitted together with the next wait, one vectored send per
+// connection. A multishot poll watches the wake fd.
+
+#define RING_ENTRIES 1024
+#define BUF_GROUP 0
+#define BUF_COUNT 1024 // Power of two
+#define BUF_SIZE 4096
+
+// user_data carries the Conn pointer with the operation in its low bits
+enum {
+  OP_ACCEPT,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL,
+  OP_WAKE
+};
+
+#define TAG(c,op) ((uint64_t)(uintptr_t)(c) | (op))
+#define TAG_CONN(t) ((Conn *)(uintptr_t)((t) & ~(uint64_t)7))
+#define TAG_OP(t) ((int)((t) & 7))
+
+static _Thread_local struct {
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_pending_tail;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *buf_ring;
+  unsigned short buf_tail;
+  char *bufs;
+
+  int listen_fd;
+  int wake_fd;
+  IoHandler *handler;
+  Conn *queued;
+} ring;
+
+
+
+static int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+  } while(ret < 0 && errno == EINTR);
+  return ret;
+}
+
+
+
+// Publish queued SQEs and optionally wait for a completion
+static void submit(bool wait) {
+  unsigned tail = *ring.sq_tail;
+  unsigned n = ring.sq_pending_tail - tail;
+  __atomic_store_n(ring.sq_tail, ring.sq_pending_tail, __ATOMIC_RELEASE);
+
+  if(n > 0 || wait) {
+    if(enter(n, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0) < 0) {
+      perror("io_uring_enter");
+    }
+  }
+}
+
+
+
+static struct io_uring_sqe *get_sqe(void) {
+  unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+  if(ring.sq_pending_tail - head >= ring.sq_entries) {
+    submit(false);
+    head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  unsigned idx = ring.sq_pending_tail & ring.sq_mask;
+  struct io_uring_sqe *sqe = &ring.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sq_array[idx] = idx;
+  ring.sq_pending_tail++;
+  return sqe;
+}
+
+
+
+static void buf_recycle(unsigned short bid) {
+  // Only touch addr/len/bid: the ring tail aliases the first entry's resv
+  struct io_uring_buf *b = &ring.buf_ring->bufs[ring.buf_tail & (BUF_COUNT - 1)];
+  b->addr = (uintptr_t)(ring.bufs + (size_t)bid * BUF_SIZE);
+  b->len = BUF_SIZE;
+  b->bid = bid;
+  ring.buf_tail++;
+  __atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+
+
+static void arm_accept(void) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = ring.listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = TAG(NULL, OP_ACCEPT);
+}
+
+
+
+static void arm_wake(void) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = ring.wake_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = TAG(NULL, OP_WAKE);
+}
+
+
+
+static void arm_recv(Conn *c) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = TAG(c, OP_RECV);
+  c->receiving = true;
+  c->inflight++;
+}
+
+
+
+// Blocks never move and are only freed once sent, so the iovecs stay valid
+// while the send is in flight even if more output is queued meanwhile
+static void arm_send(Conn *c) {
+  c->msg.msg_iov = c->iov;
+  c->msg.msg_iovlen = sendq_iov(&c->out, c->iov, SENDQ_IOV);
+
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = c->fd;
+  sqe->addr = (uintptr_t)&c->msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = TAG(c, OP_SEND);
+  c->sending = true;
+  c->inflight++;
+}
+
+
+
+static void enqueue(Conn *c) {
+  if(c->queued) return;
+  c->queued = true;
+  c->next_queued = ring.queued;
+  ring.queued = c;
+}
+
+
+
+static void release_if_idle(Conn *c) {
+  if(!c->closing || c->inflight > 0 || c->queued) return;
+
+  close(c->fd);
+  sendq_clear(&c->out);
+  free(c->held);
+  c->held = NULL;
+  c->held_len = 0;
+  ring.handler->release(c);
+}
+
+
+
+static void cancel_recv(Conn *c) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = TAG(c, OP_RECV);
+  sqe->user_data = TAG(c, OP_CANCEL);
+  c->inflight++;
+}
+
+
+
+// Stop receiving. Output already queued is still flushed before the fd is
+// closed, so a QUIT reply reaches the client.
+static void start_close(Conn *c) {
+  if(c->closing) return;
+  c->closing = true;
+  if(c->receiving && !c->paused) cancel_recv(c);
+}
+
+
+
+static void flush_queued(void) {
+  while(ring.queued) {
+    Conn *c = ring.queued;
+    ring.queued = c->next_queued;
+    c->queued = false;
+
+    if(!c->sending && c->out.bytes > 0) arm_send(c);
+
+    release_if_idle(c);
+  }
+}
+
+
+
+// Too much output is queued: stop the recv and keep whatever it delivers
+// before the cancel lands until the connection drains
+static void pause_recv(Conn *c) {
+  c->paused = true;
+  if(c->receiving) cancel_recv(c);
+}
+
+
+
+static void hold(Conn *c, const char *data, size_t n) {
+  char *held = realloc(c->held, c->held_len + n);
+  if(!held) {
+    start_close(c);
+    return;
+  }
+  memcpy(held + c->held_len, data, n);
+  c->held = held;
+  c->held_len += n;
+}
+
+
+
+static void feed(Conn *c, const char *data, size_t n) {
+  while(n > 0 && !c->closing && !c->paused) {
+    size_t taken = linebuf_append(&c->in, data, n);
+    data += taken;
+    n -= taken;
+    if(ring.handler->input(c) < 0) start_close(c);
+    else if(io_backlogged(c)) pause_recv(c);
+  }
+
+  if(n > 0 && c->paused && !c->closing) hold(c, data, n);
+}
+
+
+
+static void resume_recv(Conn *c) {
+  c->paused = false;
+
+  char *held = c->held;
+  size_t held_len = c->held_len;
+  c->held = NULL;
+  c->held_len = 0;
+
+  // Lines left in the buffer when the connection paused come first
+  if(ring.handler->input(c) < 0) start_close(c);
+  else if(io_backlogged(c)) pause_recv(c);
+  feed(c, held, held_len);
+  free(held);
+
+  if(!c->paused && !c->closing && !c->receiving) arm_recv(c);
+}
+
+
+
+static void on_recv(Conn *c, struct io_uring_cqe *cqe) {
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if(!more) {
+    c->inflight--;
+    c->receiving = false;
+  }
+
+  if(cqe->res > 0) {
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if(c->paused) hold(c, ring.bufs + (size_t)bid * BUF_SIZE, cqe->res);
+    else feed(c, ring.bufs + (size_t)bid * BUF_SIZE, cqe->res);
+    buf_recycle(bid);
+  } else if(cqe->res == 0 || (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+    start_close(c);
+  }
+
+  // ENOBUFS: every provided buffer is in use; try again once some come back
+  if(!more && !c->closing && !c->paused) arm_recv(c);
+  release_if_idle(c);
+}
+
+
+
+static void on_send(Conn *c, struct io_uring_cqe *cqe) {
+  c->inflight--;
+  c->sending = false;
+
+  if(cqe->res < 0) {
+    sendq_clear(&c->out);
+    start_close(c);
+  } else {
+    io_sent(c, cqe->res);
+    if(c->out.bytes > 0) enqueue(c);
+    if(c->paused && !c->closing && io_drained(c)) resume_recv(c);
+  }
+
+  release_if_idle(c);
+}
+
+
+
+static void on_accept(struct io_uring_cqe *cqe) {
+  if(!(cqe->flags & IORING_CQE_F_MORE)) arm_accept();
+  if(cqe->res < 0) {
+    LOG(LOG_ERROR, "accept: %s", strerror(-cqe->res));
+    return;
+  }
+  setsockopt(cqe->res, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+  Conn *c = ring.handler->accept(cqe->res);
+  if(!c) {
+    close(cqe->res);
+    return;
+  }
+
+  arm_recv(c);
+}
+
+
+
+static bool init(int listen_fd, int wake_fd, IoHandler *h) {
+  ring.listen_fd = listen_fd;
+  ring.wake_fd = wake_fd;
+  ring.handler = h;
+
+  struct io_uring_params p = {};
+  ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if(ring.fd < 0) {
+    perror("io_uring_setup");
+    return false;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    if(cq_size > sq_size) sq_size = cq_size;
+    cq_size = sq_size;
+  }
+
+  char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  char *cq = sq;
+  if(sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+  }
+  ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if(sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    perror("mmap");
+    close(ring.fd);
+    return false;
+  }
+
+  ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring.sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  ring.sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+  ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring.sq_pending_tail = *ring.sq_tail;
+
+  ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring.cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  ring.buf_ring = mmap(NULL, BUF_COUNT * sizeof(struct io_uring_buf),
+      PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  ring.bufs = malloc((size_t)BUF_COUNT * BUF_SIZE);
+  if(ring.buf_ring == MAP_FAILED || !ring.bufs) {
+    perror("buffers");
+    close(ring.fd);
+    return false;
+  }
+
+  struct io_uring_buf_reg reg = {
+    .ring_addr = (uintptr_t)ring.buf_ring,
+    .ring_entries = BUF_COUNT,
+    .bgid = BUF_GROUP
+  };
+  if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("io_uring_register");
+    close(ring.fd);
+    return false;
+  }
+
+  for(unsigned short i = 0; i < BUF_COUNT; i++) buf_recycle(i);
+
+  arm_accept();
+  arm_wake();
+  return true;
+}
+
+
+
+static void run(void) {
+  while(1) {
+    flush_queued();
+    submit(true);
+
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+      Conn *c = TAG_CONN(cqe->user_data);
+
+      switch(TAG_OP(cqe->user_data)) {
+      case OP_ACCEPT:
+        on_accept(cqe);
+        break;
+
+      case OP_RECV:
+        on_recv(c, cqe);
+        break;
+
+      case OP_SEND:
+        on_send(c, cqe);
+        break;
+
+      case OP_CANCEL:
+        c->inflight--;
+        release_if_idle(c);
+        break;
+
+      case OP_WAKE:
+        if(!(cqe->flags & IORING_CQE_F_MORE)) arm_wake();
+        eventfd_t value;
+        eventfd_read(ring.wake_fd, &value);
+        ring.handler->wake();
+        break;
+      }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+
+
+static void send_(Conn *c, const char *msg, size_t len) {
+  if(c->closing) return;
+  if(io_queue(c, msg, len, NULL)) enqueue(c);
+  else start_close(c);
+}
+
+
+
+static void send_shared(Conn *c, WireBuf *buf) {
+  if(c->closing) return;
+  if(io_queue(c, NULL, 0, buf)) enqueue(c);
+  else start_close(c);
+}
+
+
+
+// Handled like a connection resuming from a pause: lines already buffered
+// first, then a recv unless it is still backlogged
+static bool adopt(Conn *c) {
+  resume_recv(c);
+  enqueue(c);
+  return true;
+}
+
+
+
+IoBackend io_uring = {
+  .name = "io_uring",
+  .init = init,
+  .run = run,
+  .send = send_,
+  .send_shared = send_shared,
+  .adopt = adopt,
+};
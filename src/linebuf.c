@@ -0,0 +1,115 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "linebuf.h"
+
+
+
+void linebuf_reset(LineBuf *b) {
+  b->start = b->scanned = b->end = 0;
+  b->overflow = false;
+}
+
+
+
+size_t linebuf_scan(const char *s, size_t n) {
+  size_t i = 0;
+
+#ifdef __AVX2__
+  const __m256i nl32 = _mm256_set1_epi8('\n');
+  for(; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl32));
+    if(mask) return i + __builtin_ctz(mask);
+  }
+#endif
+
+#ifdef __SSE2__
+  const __m128i nl16 = _mm_set1_epi8('\n');
+  for(; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl16));
+    if(mask) return i + __builtin_ctz(mask);
+  }
+#endif
+
+  for(; i < n; i++) {
+    if(s[i] == '\n') return i;
+  }
+  return n;
+}
+
+
+
+static void compact(LineBuf *b) {
+  if(b->start == b->end) {
+    b->start = b->scanned = b->end = 0;
+  } else if(LINEBUF_SIZE - b->end < MESSAGE_MAX_LEN) {
+    size_t n = b->end - b->start;
+    memmove(b->data, b->data + b->start, n);
+    b->scanned -= b->start;
+    b->start = 0;
+    b->end = n;
+  }
+}
+
+
+
+ssize_t linebuf_read(LineBuf *b, int fd) {
+  compact(b);
+
+  while(1) {
+    ssize_t n = read(fd, b->data + b->end, LINEBUF_SIZE - b->end);
+    if(n < 0 && errno == EINTR) continue;
+    if(n > 0) b->end += n;
+    return n;
+  }
+}
+
+
+
+// For backends that receive into their own buffers. Copies as much of data
+// as fits and returns the count; drain lines before appending the rest.
+size_t linebuf_append(LineBuf *b, const char *data, size_t n) {
+  compact(b);
+
+  if(n > LINEBUF_SIZE - b->end) n = LINEBUF_SIZE - b->end;
+  memcpy(b->data + b->end, data, n);
+  b->end += n;
+  return n;
+}
+
+
+
+char *linebuf_next(LineBuf *b, size_t *len) {
+  while(1) {
+    size_t off = b->scanned + linebuf_scan(b->data + b->scanned, b->end - b->scanned);
+
+    if(off == b->end) {
+      b->scanned = b->end;
+      // No terminator within the limit, so drop what we have and skip the
+      // rest of this line when it arrives
+      if(b->end - b->start > MESSAGE_MAX_LEN) {
+        b->overflow = true;
+        b->start = b->end;
+      }
+      return NULL;
+    }
+
+    char *line = b->data + b->start;
+    size_t n = off + 1 - b->start;
+    b->start = b->scanned = off + 1;
+
+    if(b->overflow) {
+      b->overflow = false;
+      continue;
+    }
+    if(n > MESSAGE_MAX_LEN) continue;
+
+    *len = n;
+    return line;
+  }
+}
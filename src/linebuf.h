@@ -0,0 +1,31 @@
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "message.h"
+
+#define LINEBUF_SIZE (MESSAGE_MAX_LEN*4)
+
+// Receive buffer for one connection. Large reads append at the tail and
+// complete lines are handed out in place, so the parser can work on them
+// without copying. A trailing partial line carries over to the next read and
+// is moved back to the front once the tail runs out of room.
+typedef struct {
+  size_t start;   // First byte not yet handed out
+  size_t scanned; // No '\n' in [start, scanned)
+  size_t end;     // One past the last byte received
+  bool overflow;  // Discarding an over-long line up to its '\n'
+  char data[LINEBUF_SIZE];
+} LineBuf;
+
+void linebuf_reset(LineBuf *b);
+ssize_t linebuf_read(LineBuf *b, int fd);
+size_t linebuf_append(LineBuf *b, const char *data, size_t n);
+char *linebuf_next(LineBuf *b, size_t *len);
+
+// Offset of the first '\n' in s[0..n), or n if there is none
+size_t linebuf_scan(const char *s, size_t n);
+
+#endif
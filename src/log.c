@@ -0,0 +1,542 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "log.h"
+
+#define LOG_SPEC 32 // Longest conversion spec the writer rebuilds
+
+// One slot of the ring. seq follows Vyukov's bounded queue: a slot at
+// position pos is free when seq == pos and holds a record when
+// seq == pos + 1, so producers claim slots with one CAS on tail and the
+// writer never takes a lock.
+//
+// A record holds one of three things:
+//  - label set: a raw line, len bytes before cutting
+//  - fmt set: fmt's arguments as len 8-byte words, followed by the strings
+//    they point to, each NUL-terminated; the writer formats them
+//  - neither: text the caller formatted itself, len bytes before cutting
+typedef struct {
+  atomic_size_t seq;
+  uint64_t time_ns;
+  const char *label;
+  const char *fmt;
+  uint32_t len;
+  uint8_t level;
+  bool cut; // A string argument didn't fit
+  char data[LOG_DATA];
+} LogRecord;
+
+// How a conversion's argument is passed, and so how it is stored
+enum {
+  ARG_NONE, // %%
+  ARG_INT,
+  ARG_LONG,
+  ARG_LLONG,
+  ARG_INTMAX,
+  ARG_SIZE,
+  ARG_PTRDIFF,
+  ARG_DOUBLE,
+  ARG_PTR,
+  ARG_STR
+};
+
+typedef struct {
+  const char *end; // One past the conversion character
+  int arg;
+  bool star_width;
+  bool star_prec;
+  bool has_prec;
+} LogSpec;
+
+int log_level = LOG_INFO;
+
+static const char *const level_names[] = {
+#define X(l) #l,
+LOG_LEVELS
+#undef X
+};
+
+static LogRecord ring[LOG_RING];
+static atomic_size_t tail;
+static size_t head; // Writer only
+static atomic_uint_fast64_t dropped;
+
+static atomic_bool running;
+static atomic_bool stopping;
+static pthread_t writer;
+
+// The writer sleeps on wake_fd once the ring is empty, and the first
+// producer to find it asleep wakes it
+static atomic_bool sleeping;
+static int wake_fd = -1;
+
+
+
+int log_level_named(const char *name) {
+  for(int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+    if(!strcasecmp(level_names[i], name)) return i;
+  }
+  return -1;
+}
+
+
+
+uint64_t log_dropped(void) {
+  return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+
+
+// Parse the conversion spec at p, which points at its '%'. Returns false
+// for anything the writer can't rebuild from stored words, such as %n, %ls
+// or long double.
+static bool spec_parse(const char *p, LogSpec *s) {
+  const char *start = p++;
+  *s = (LogSpec){};
+
+  while(*p && strchr("-+ #0", *p)) p++;
+  if(*p == '*') {
+    s->star_width = true;
+    p++;
+  }
+  while(isdigit((unsigned char)*p)) p++;
+  if(*p == '.') {
+    s->has_prec = true;
+    if(*++p == '*') {
+      s->star_prec = true;
+      p++;
+    }
+    while(isdigit((unsigned char)*p)) p++;
+  }
+
+  char len = 0;
+  if((p[0] == 'h' || p[0] == 'l') && p[1] == p[0]) {
+    len = p[0] == 'h' ? 'H' : 'q';
+    p += 2;
+  } else if(*p && strchr("hljztL", *p)) {
+    len = *p++;
+  }
+
+  char conv = *p;
+  s->end = p + 1;
+  if(!conv || s->end - start >= LOG_SPEC) return false;
+
+  if(conv == '%') {
+    s->arg = ARG_NONE;
+  } else if(strchr("diouxXc", conv)) {
+    if(conv == 'c' && len) return false;
+    switch(len) {
+    case 0: case 'H': case 'h': s->arg = ARG_INT; break;
+    case 'l': s->arg = ARG_LONG; break;
+    case 'q': s->arg = ARG_LLONG; break;
+    case 'j': s->arg = ARG_INTMAX; break;
+    case 'z': s->arg = ARG_SIZE; break;
+    case 't': s->arg = ARG_PTRDIFF; break;
+    default: return false;
+    }
+  } else if(strchr("fFeEgGaA", conv) && (!len || len == 'l')) {
+    s->arg = ARG_DOUBLE;
+  } else if(conv == 'p' && !len) {
+    s->arg = ARG_PTR;
+  } else if(conv == 's' && !len) {
+    s->arg = ARG_STR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+
+// Words fmt's arguments take, counting '*' widths and precisions, or -1 if
+// the writer can't format it
+static int spec_words(const char *fmt) {
+  int n = 0;
+  LogSpec s;
+  for(const char *p = fmt; (p = strchr(p, '%')); p = s.end) {
+    if(!spec_parse(p, &s)) return -1;
+    if(s.arg != ARG_NONE) n += 1 + s.star_width + s.star_prec;
+  }
+  return n;
+}
+
+
+
+static void put_word(LogRecord *r, size_t *n, uint64_t v) {
+  memcpy(r->data + *n * sizeof(v), &v, sizeof(v));
+  (*n)++;
+}
+
+
+
+// Store fmt's arguments in r, copying strings since the caller may free
+// them before the writer gets to the record. Returns false if they don't
+// fit as words.
+static bool capture(LogRecord *r, const char *fmt, va_list args) {
+  int words = spec_words(fmt);
+  if(words < 0 || words * sizeof(uint64_t) > LOG_DATA) return false;
+
+  size_t n = 0;
+  char *str = r->data + words * sizeof(uint64_t);
+  char *end = r->data + LOG_DATA;
+  r->fmt = fmt;
+  r->len = words;
+  r->cut = false;
+
+  LogSpec s;
+  for(const char *p = fmt; (p = strchr(p, '%')); p = s.end) {
+    spec_parse(p, &s);
+    int prec = -1;
+    if(s.star_width) put_word(r, &n, (int64_t)va_arg(args, int));
+    if(s.star_prec) put_word(r, &n, (int64_t)(prec = va_arg(args, int)));
+    else if(s.has_prec) prec = atoi(strchr(p, '.') + 1);
+
+    switch(s.arg) {
+    case ARG_INT: put_word(r, &n, (int64_t)va_arg(args, int)); break;
+    case ARG_LONG: put_word(r, &n, (int64_t)va_arg(args, long)); break;
+    case ARG_LLONG: put_word(r, &n, (int64_t)va_arg(args, long long)); break;
+    case ARG_INTMAX: put_word(r, &n, (int64_t)va_arg(args, intmax_t)); break;
+    case ARG_SIZE: put_word(r, &n, va_arg(args, size_t)); break;
+    case ARG_PTRDIFF: put_word(r, &n, (int64_t)va_arg(args, ptrdiff_t)); break;
+    case ARG_PTR: put_word(r, &n, (uintptr_t)va_arg(args, void *)); break;
+
+    case ARG_DOUBLE: {
+      double d = va_arg(args, double);
+      uint64_t v;
+      memcpy(&v, &d, sizeof(v));
+      put_word(r, &n, v);
+      break;
+    }
+
+    case ARG_STR: {
+      const char *a = va_arg(args, const char *);
+      if(!a) a = "(null)";
+      size_t len = prec >= 0 ? strnlen(a, prec) : strlen(a);
+      if(len + 1 > end - str) {
+        len = end - str ? end - str - 1 : 0;
+        r->cut = true;
+      }
+      if(str < end) {
+        memcpy(str, a, len);
+        str[len] = 0;
+        str += len + 1;
+      }
+      put_word(r, &n, len);
+      break;
+    }
+    }
+  }
+  return true;
+}
+
+
+
+static uint64_t get_word(const LogRecord *r, size_t *n) {
+  uint64_t v;
+  memcpy(&v, r->data + *n * sizeof(v), sizeof(v));
+  (*n)++;
+  return v;
+}
+
+
+
+// Format a record of stored arguments, one conversion at a time. '*'
+// widths and precisions are written into the spec as numbers.
+static void emit_format(const LogRecord *r, FILE *f) {
+  size_t n = 0;
+  const char *str = r->data + r->len * sizeof(uint64_t);
+  const char *p = r->fmt;
+  const char *pct;
+  LogSpec s;
+
+  for(; (pct = strchr(p, '%')); p = s.end) {
+    fwrite(p, 1, pct - p, f);
+    spec_parse(pct, &s);
+    if(s.arg == ARG_NONE) {
+      putc_unlocked('%', f);
+      continue;
+    }
+
+    char spec[LOG_SPEC + 24];
+    size_t k = 0;
+    for(const char *q = pct; q < s.end; q++) {
+      if(*q == '.' && q[1] == '*') {
+        int prec = (int64_t)get_word(r, &n);
+        if(prec >= 0) k += sprintf(spec + k, ".%d", prec);
+        q++;
+      } else if(*q == '*') {
+        k += sprintf(spec + k, "%d", (int)(int64_t)get_word(r, &n));
+      } else {
+        spec[k++] = *q;
+      }
+    }
+    spec[k] = 0;
+
+    uint64_t v = get_word(r, &n);
+    switch(s.arg) {
+    case ARG_INT: fprintf(f, spec, (int)(int64_t)v); break;
+    case ARG_LONG: fprintf(f, spec, (long)(int64_t)v); break;
+    case ARG_LLONG: fprintf(f, spec, (long long)(int64_t)v); break;
+    case ARG_INTMAX: fprintf(f, spec, (intmax_t)(int64_t)v); break;
+    case ARG_SIZE: fprintf(f, spec, (size_t)v); break;
+    case ARG_PTRDIFF: fprintf(f, spec, (ptrdiff_t)(int64_t)v); break;
+    case ARG_PTR: fprintf(f, spec, (void *)(uintptr_t)v); break;
+
+    case ARG_DOUBLE: {
+      double d;
+      memcpy(&d, &v, sizeof(d));
+      fprintf(f, spec, d);
+      break;
+    }
+
+    // Strings that found no room at all weren't stored
+    case ARG_STR:
+      if(str < r->data + LOG_DATA) {
+        fprintf(f, spec, str);
+        str += v + 1;
+      } else {
+        fprintf(f, spec, "");
+      }
+      break;
+    }
+  }
+  fputs(p, f);
+  if(r->cut) fputs("...", f);
+}
+
+
+
+// Store fmt's arguments in r, or format them here if the writer can't
+static void fill(LogRecord *r, const char *fmt, va_list args) {
+  va_list copy;
+  va_copy(copy, args);
+  if(!capture(r, fmt, copy)) {
+    int n = vsnprintf(r->data, LOG_DATA, fmt, args);
+    r->fmt = NULL;
+    r->len = n < 0 ? 0 : n;
+  }
+  va_end(copy);
+  r->label = NULL;
+}
+
+
+
+// Everything after the time and level
+static void emit_text(const LogRecord *r, FILE *f) {
+  size_t n = r->len < LOG_DATA ? r->len : LOG_DATA;
+  if(r->fmt) {
+    emit_format(r, f);
+  } else if(!r->label) {
+    if(n == LOG_DATA) n--; // vsnprintf kept the last byte for its NUL
+    fwrite(r->data, 1, n, f);
+    if(r->len > n) fputs("...", f);
+  } else {
+    fprintf(f, "%s ", r->label);
+    for(size_t i = 0; i < n; i++) {
+      unsigned char c = r->data[i];
+      switch(c) {
+      case '\r': fputs("\\r", f); break;
+      case '\n': fputs("\\n", f); break;
+      default:
+        if(c < ' ' || c == 0x7f) fprintf(f, "\\x%02x", c);
+        else putc_unlocked(c, f);
+      }
+    }
+    if(r->len > n) fprintf(f, "... (%u bytes)", r->len);
+  }
+}
+
+
+
+static void emit(const LogRecord *r) {
+  FILE *f = r->level >= LOG_WARN ? stderr : stdout;
+
+  time_t secs = r->time_ns / 1000000000;
+  struct tm tm;
+  localtime_r(&secs, &tm);
+  fprintf(f, "%02d:%02d:%02d.%03d %-5s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+      (int)(r->time_ns / 1000000 % 1000), level_names[r->level]);
+  emit_text(r, f);
+  putc_unlocked('\n', f);
+}
+
+
+
+void log_render(FILE *f, const char *fmt, ...) {
+  LogRecord r;
+  va_list args;
+  va_start(args, fmt);
+  fill(&r, fmt, args);
+  va_end(args);
+  emit_text(&r, f);
+}
+
+
+
+static size_t drain(void) {
+  size_t n = 0;
+  while(1) {
+    LogRecord *r = &ring[head & (LOG_RING - 1)];
+    if(atomic_load_explicit(&r->seq, memory_order_acquire) != head + 1) break;
+    emit(r);
+    atomic_store_explicit(&r->seq, head + LOG_RING, memory_order_release);
+    head++;
+    n++;
+  }
+
+  if(n) {
+    fflush(stdout);
+    fflush(stderr);
+  }
+  return n;
+}
+
+
+
+static bool ring_ready(void) {
+  return atomic_load_explicit(&ring[head & (LOG_RING - 1)].seq, memory_order_acquire) == head + 1;
+}
+
+
+
+static void *writer_run(void *arg) {
+  uint64_t reported = 0;
+  while(!atomic_load(&stopping)) {
+    size_t n = drain();
+
+    uint64_t d = log_dropped();
+    if(d != reported) {
+      fprintf(stderr, "%"PRIu64" log records dropped\n", d - reported);
+      reported = d;
+    }
+    if(n) continue;
+
+    // Look at the ring again after saying we sleep: a producer either sees
+    // the flag or published before the second look
+    atomic_store(&sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(ring_ready() || atomic_load(&stopping)) {
+      atomic_store(&sleeping, false);
+      continue;
+    }
+    eventfd_t value;
+    eventfd_read(wake_fd, &value);
+  }
+  return NULL;
+}
+
+
+
+bool log_start(void) {
+  for(size_t i = 0; i < LOG_RING; i++) atomic_init(&ring[i].seq, i);
+
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+  if(wake_fd < 0) return false;
+  if(pthread_create(&writer, NULL, writer_run, NULL) != 0) return false;
+  atomic_store(&running, true);
+  atexit(log_stop);
+  return true;
+}
+
+
+
+void log_stop(void) {
+  if(!atomic_exchange(&running, false)) return;
+  atomic_store(&stopping, true);
+  eventfd_write(wake_fd, 1);
+  pthread_join(writer, NULL);
+  drain();
+}
+
+
+
+// Hand a claimed record to the writer, waking it if it sleeps
+static void publish(LogRecord *r, size_t pos) {
+  atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load_explicit(&sleeping, memory_order_relaxed) && atomic_exchange(&sleeping, false)) {
+    eventfd_write(wake_fd, 1);
+  }
+}
+
+
+
+// Claim a slot and return it with its position, or NULL if the ring is full
+static LogRecord *claim(size_t *pos) {
+  size_t p = atomic_load_explicit(&tail, memory_order_relaxed);
+  while(1) {
+    LogRecord *r = &ring[p & (LOG_RING - 1)];
+    size_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+    if(seq == p) {
+      if(atomic_compare_exchange_weak_explicit(&tail, &p, p + 1,
+          memory_order_relaxed, memory_order_relaxed)) {
+        *pos = p;
+        return r;
+      }
+    } else if((intptr_t)(seq - p) < 0) {
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return NULL;
+    } else {
+      p = atomic_load_explicit(&tail, memory_order_relaxed);
+    }
+  }
+}
+
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+void log_printf(int level, const char *fmt, ...) {
+  LogRecord local;
+  LogRecord *r = &local;
+  size_t pos = 0;
+  bool async = atomic_load_explicit(&running, memory_order_relaxed);
+  if(async && !(r = claim(&pos))) return;
+
+  va_list args;
+  va_start(args, fmt);
+  fill(r, fmt, args);
+  va_end(args);
+
+  r->time_ns = now_ns();
+  r->level = level;
+
+  if(async) publish(r, pos);
+  else emit(r);
+}
+
+
+
+void log_line(int level, const char *label, const char *s, size_t len) {
+  LogRecord local;
+  LogRecord *r = &local;
+  size_t pos = 0;
+  bool async = atomic_load_explicit(&running, memory_order_relaxed);
+  if(async && !(r = claim(&pos))) return;
+
+  memcpy(r->data, s, len < LOG_DATA ? len : LOG_DATA);
+  r->time_ns = now_ns();
+  r->label = label;
+  r->fmt = NULL;
+  r->len = len;
+  r->level = level;
+
+  if(async) publish(r, pos);
+  else emit(r);
+}
@@ -0,0 +1,66 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Leveled logging off the I/O path. Callers copy the format string and its
+// arguments into a fixed-size record in a bounded lock-free ring and move
+// on; a background thread formats and writes the records in order. Format
+// strings must outlive the record, as literals do; %s arguments are copied.
+// When the ring is full the record is dropped and counted rather than
+// waiting for the writer. WARN and above go to stderr, the rest to stdout.
+//
+// Until log_start() runs, records are written synchronously instead.
+
+#define LOG_LEVELS \
+X(TRACE) \
+X(DEBUG) \
+X(INFO) \
+X(WARN) \
+X(ERROR)
+
+enum {
+#define X(l) LOG_##l,
+LOG_LEVELS
+#undef X
+};
+
+#define LOG_RING 4096 // Records, a power of two
+#define LOG_DATA 224  // Bytes of arguments or text per record; longer text is cut
+
+// Records below this level are skipped before any formatting. Set it before
+// starting threads.
+extern int log_level;
+
+// Returns the level called name, or -1
+int log_level_named(const char *name);
+
+bool log_start(void);
+
+// Drain the ring and stop the writer; registered with atexit() by log_start()
+void log_stop(void);
+
+// Records dropped because the ring was full
+uint64_t log_dropped(void);
+
+#define LOG(level, ...) do { \
+  if((level) >= log_level) log_printf(level, __VA_ARGS__); \
+} while(0)
+
+// Log s[0..len) as a raw protocol line under label. The bytes are copied as
+// they are and escaped by the writer.
+#define LOG_LINE(level, label, s, len) do { \
+  if((level) >= log_level) log_line(level, label, s, len); \
+} while(0)
+
+void log_printf(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_line(int level, const char *label, const char *s, size_t len);
+
+// Write what LOG() would for fmt, without the time and level, to f: the
+// arguments go through a record and are formatted as the writer would
+void log_render(FILE *f, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
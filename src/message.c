@@ -6,6 +6,7 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 #include "message.h"
+#include "linebuf.h"
 #include "util.h"
 
 #define CALLOUT_TAG 1
@@ -183,12 +184,26 @@ void get_group(int g, pcre2_callout_block *block, char **start, int *len) {
 
 
 
-#define R(cap,dst) \
+// Fields come from the arena when there is one; otherwise each is its own
+// allocation, replacing whatever an earlier attempt of the match stored
+#define R(cap,dst,dst_len) \
   get_group(CAPTURE_GROUP_##cap, block, &start, &len); \
-  new = len > 0 ? strndup(start,len) : NULL; \
-  replace(&m->dst, new);
+  if(ctx->arena) { \
+    m->dst = len > 0 ? arena_strndup(ctx->arena, start, len) : NULL; \
+  } else { \
+    new = len > 0 ? strndup(start,len) : NULL; \
+    replace(&m->dst, new); \
+  } \
+  m->dst_len = m->dst ? len : 0;
+
+typedef struct {
+  Message *m;
+  Arena *arena;
+} CalloutContext;
+
 static int new_message_callout(pcre2_callout_block *block, void *data) {
-  Message *m = data;
+  CalloutContext *ctx = data;
+  Message *m = ctx->m;
   char *start;
   int len;
   char *new;
@@ -196,29 +211,29 @@ static int new_message_callout(pcre2_callout_block *block, void *data) {
   switch(block->callout_number) {
   case CALLOUT_TAG:
     if(m->num_tags < MESSAGE_MAX_TAGS) {
-      R(tag_key, tags[m->num_tags].key);
-      R(tag_value, tags[m->num_tags].value);
+      R(tag_key, tags[m->num_tags].key, tags[m->num_tags].key_len);
+      R(tag_value, tags[m->num_tags].value, tags[m->num_tags].value_len);
       m->num_tags++;
     }
     break;
 
   case CALLOUT_PREFIX_HOSTONLY:
-    R(prefix_hostonly, prefix.host);
+    R(prefix_hostonly, prefix.host, prefix.host_len);
     break;
 
   case CALLOUT_PREFIX:
-    R(prefix_nick, prefix.nick);
-    R(prefix_user, prefix.user);
-    R(prefix_host, prefix.host);
+    R(prefix_nick, prefix.nick, prefix.nick_len);
+    R(prefix_user, prefix.user, prefix.user_len);
+    R(prefix_host, prefix.host, prefix.host_len);
     break;
 
   case CALLOUT_COMMAND:
-    R(command, command);
+    R(command, command, command_len);
     break;
 
   case CALLOUT_ARGUMENT:
     if(m->num_args < MESSAGE_MAX_ARGS) {
-      R(argument, args[m->num_args]);
+      R(argument, args[m->num_args], args_len[m->num_args]);
       m->num_args++;
     }
     break;
@@ -229,7 +244,7 @@ static int new_message_callout(pcre2_callout_block *block, void *data) {
 
 
 
-Message message_new(char *s) {
+Message message_new_pcre2(char *s, Arena *arena) {
   static pcre2_code *regex = NULL;
 
   if(!regex) {
@@ -258,10 +273,11 @@ Message message_new(char *s) {
     }
   }
 
-  Message m = {};
+  Message m = { .owned = !arena, .tags_split = true };
+  CalloutContext ctx = { .m = &m, .arena = arena };
 
   pcre2_match_context *match_context = pcre2_match_context_create(NULL);
-  pcre2_set_callout(match_context, new_message_callout, &m);
+  pcre2_set_callout(match_context, new_message_callout, &ctx);
   pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(regex, NULL);
 
   int ret = pcre2_match(
@@ -281,45 +297,416 @@ Message message_new(char *s) {
 
 
 
-bool message_tostring(Message *m, char *dst, size_t n) {
-  size_t cursor = 0;
+// Split off the next space-delimited field starting at *p, terminating it
+// in place. Returns the field length and leaves *p at the following byte.
+static inline size_t field(char **p, char *end) {
+  char *start = *p;
+  char *space = memchr(start, ' ', end - start);
+  if(!space) space = end;
+  *space = '\0';
+  *p = space < end ? space + 1 : end;
+  return space - start;
+}
 
-  if(m->num_tags > 0) {
-    cursor += snprintf(dst+cursor, n-cursor, "@");
-    for(int i = 0; i < m->num_tags; i++) {
-      cursor += snprintf(dst+cursor, n-cursor, "%s%s=%s",
-          i > 0 ? ";" : "",
-          m->tags[i].key,
-          m->tags[i].value ? m->tags[i].value : "");
+
+
+static void parse_tags(Message *m, char *p, char *end) {
+  while(p < end) {
+    char *semi = memchr(p, ';', end - p);
+    if(!semi) semi = end;
+    *semi = '\0';
+
+    if(semi > p && m->num_tags < MESSAGE_MAX_TAGS) {
+      char *eq = memchr(p, '=', semi - p);
+      m->tags[m->num_tags].key = p;
+      if(eq) {
+        *eq = '\0';
+        m->tags[m->num_tags].key_len = eq - p;
+        m->tags[m->num_tags].value = eq + 1;
+        m->tags[m->num_tags].value_len = semi - eq - 1;
+      } else {
+        m->tags[m->num_tags].key_len = semi - p;
+        m->tags[m->num_tags].value = semi;
+        m->tags[m->num_tags].value_len = 0;
+      }
+      m->num_tags++;
     }
-    cursor += snprintf(dst+cursor, n-cursor, " ");
+
+    p = semi + 1;
   }
+}
+
+
 
-  if(m->prefix.host && !m->prefix.nick && !m->prefix.user) {
-    cursor += snprintf(dst+cursor, n-cursor, ":%s ", m->prefix.host);
-  } else {
-    cursor += snprintf(dst+cursor, n-cursor, ":%s%s%s%s%s ",
-        m->prefix.nick,
-        m->prefix.user ? "!" : "",
-        m->prefix.user ? m->prefix.user : "",
-        m->prefix.host ? "@" : "",
-        m->prefix.host ? m->prefix.host : "");
+static void parse_prefix(Message *m, char *p, char *end) {
+  char *bang = memchr(p, '!', end - p);
+  char *at = memchr(bang ? bang : p, '@', end - (bang ? bang : p));
+
+  // A bare prefix containing a dot is a server name, as in the grammar.
+  if(!bang && !at && memchr(p, '.', end - p)) {
+    m->prefix.host = p;
+    m->prefix.host_len = end - p;
+    return;
   }
 
-  cursor += snprintf(dst+cursor, n-cursor, "%s ", m->command);
-  for(int i = 0; i < m->num_args; i++) {
-    cursor += snprintf(
-        dst+cursor, n-cursor,
-        "%s%s ",
-        strchr(m->args[i], ' ') ? ":" : "",
-        m->args[i]);
+  char *nick_end = bang ? bang : at ? at : end;
+  m->prefix.nick = p;
+  m->prefix.nick_len = nick_end - p;
+  *nick_end = '\0';
+
+  if(bang) {
+    char *user_end = at ? at : end;
+    m->prefix.user = bang + 1;
+    m->prefix.user_len = user_end - bang - 1;
+    *user_end = '\0';
   }
 
+  if(at) {
+    m->prefix.host = at + 1;
+    m->prefix.host_len = end - at - 1;
+  }
+}
+
+
+
+bool message_parse(Message *m, char *s, size_t len) {
+  m->valid = false;
+  m->owned = false;
+  m->raw_tags = NULL;
+  m->raw_tags_len = 0;
+  m->tags_split = m->tags_indexed = false;
+  m->tags_unescaped = 0;
+  m->num_tags = 0;
+  m->num_args = 0;
+  m->prefix.nick = m->prefix.user = m->prefix.host = NULL;
+  m->prefix.nick_len = m->prefix.user_len = m->prefix.host_len = 0;
+  m->command = NULL;
+  m->command_len = 0;
+
+  char *p = s;
+  char *end = s + len;
+  if(end > p && end[-1] == '\n') end--;
+  if(end > p && end[-1] == '\r') end--;
+  *end = '\0';
+
+  // Embedded line breaks mean the caller framed the input wrongly
+  if(memchr(p, '\r', end - p) || memchr(p, '\n', end - p)) return false;
+
+  // Tags stay raw until someone asks for them
+  if(p < end && *p == '@') {
+    m->raw_tags = p + 1;
+    m->raw_tags_len = field(&p, end) - 1;
+  }
+
+  if(p < end && *p == ':') {
+    char *prefix = p + 1;
+    size_t n = field(&p, end);
+    if(n < 2) return false;
+    parse_prefix(m, prefix, prefix + n - 1);
+  }
+
+  m->command = p;
+  m->command_len = field(&p, end);
+  if(m->command_len == 0) return false;
+
+  bool alpha = (unsigned)((m->command[0] | 0x20) - 'a') < 26;
+  for(size_t i = 0; i < m->command_len; i++) {
+    char c = m->command[i];
+    if(alpha ? (unsigned)((c | 0x20) - 'a') >= 26 : (unsigned)(c - '0') >= 10) {
+      return false;
+    }
+  }
+
+  // The last slot swallows the rest of the line, as a trailing argument would
+  while(p < end) {
+    if(*p == ' ') {
+      p++;
+      continue;
+    }
+
+    size_t i = m->num_args++;
+    if(*p == ':' || i == MESSAGE_MAX_ARGS - 1) {
+      if(*p == ':') p++;
+      m->args[i] = p;
+      m->args_len[i] = end - p;
+      break;
+    }
+
+    m->args[i] = p;
+    m->args_len[i] = field(&p, end);
+  }
+
+  m->valid = true;
   return true;
 }
 
 
 
+Message message_new(char *s) {
+  Message m;
+  message_parse(&m, s, strlen(s));
+  return m;
+}
+
+
+
+size_t message_parse_batch(char *buf, size_t len, Message *out, size_t cap, size_t *used) {
+  size_t n = 0;
+  size_t pos = 0;
+  while(n < cap && pos < len) {
+    size_t eol = pos + linebuf_scan(buf + pos, len - pos);
+    if(eol == len) break;
+
+    char *line = buf + pos;
+    size_t line_len = eol + 1 - pos;
+    pos = eol + 1;
+    if(line_len == 1 || (line_len == 2 && line[0] == '\r')) continue;
+
+    message_parse(&out[n++], line, line_len);
+  }
+
+  *used = pos;
+  return n;
+}
+
+
+
+size_t message_tags(Message *m) {
+  if(!m->tags_split) {
+    m->tags_split = true;
+    if(m->raw_tags) parse_tags(m, m->raw_tags, m->raw_tags + m->raw_tags_len);
+  }
+  return m->num_tags;
+}
+
+
+
+static uint32_t hash_key(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+
+// Open addressing with at least half the slots free. A repeated key
+// replaces the earlier one, as IRCv3 asks.
+static void index_tags(Message *m) {
+  memset(m->tag_index, 0, sizeof(m->tag_index));
+  size_t n = message_tags(m);
+  for(size_t i = 0; i < n; i++) {
+    size_t slot = hash_key(m->tags[i].key, m->tags[i].key_len);
+    for(;; slot++) {
+      uint8_t *e = &m->tag_index[slot & (MESSAGE_TAG_SLOTS - 1)];
+      if(*e && (m->tags[*e - 1].key_len != m->tags[i].key_len ||
+          memcmp(m->tags[*e - 1].key, m->tags[i].key, m->tags[i].key_len))) continue;
+      *e = i + 1;
+      break;
+    }
+  }
+  m->tags_indexed = true;
+}
+
+
+
+// IRCv3 escapes: \: is ';', \s is ' ', \\ is '\', \r and \n are CR and LF.
+// Any other escaped character stands for itself and a trailing '\' is
+// dropped.
+static size_t unescape_tag(char *s, size_t len) {
+  char *out = s;
+  for(size_t i = 0; i < len; i++) {
+    if(s[i] != '\\') {
+      *out++ = s[i];
+      continue;
+    }
+    if(++i == len) break;
+    switch(s[i]) {
+    case ':': *out++ = ';'; break;
+    case 's': *out++ = ' '; break;
+    case 'r': *out++ = '\r'; break;
+    case 'n': *out++ = '\n'; break;
+    default: *out++ = s[i]; break;
+    }
+  }
+  *out = '\0';
+  return out - s;
+}
+
+
+
+const char *message_get_tag(Message *m, const char *key, size_t *len) {
+  if(!m->tags_indexed) index_tags(m);
+
+  size_t key_len = strlen(key);
+  for(size_t slot = hash_key(key, key_len);; slot++) {
+    uint8_t e = m->tag_index[slot & (MESSAGE_TAG_SLOTS - 1)];
+    if(!e) return NULL;
+
+    size_t i = e - 1;
+    if(m->tags[i].key_len != key_len || memcmp(m->tags[i].key, key, key_len)) continue;
+
+    if(!m->tags[i].value) {
+      if(len) *len = 0;
+      return "";
+    }
+    if(!(m->tags_unescaped & (1ull << i))) {
+      m->tags[i].value_len = unescape_tag(m->tags[i].value, m->tags[i].value_len);
+      m->tags_unescaped |= 1ull << i;
+    }
+    if(len) *len = m->tags[i].value_len;
+    return m->tags[i].value;
+  }
+}
+
+
+
+void message_build_init(MessageBuilder *b, char *buf, size_t cap) {
+  b->buf = buf;
+  b->cap = cap;
+  b->len = 0;
+  b->overflow = false;
+}
+
+
+
+// Everything but the last two bytes, which are kept for the line ending
+void message_build_raw(MessageBuilder *b, const char *s, size_t len) {
+  size_t room = b->cap - 2 - b->len;
+  if(len > room) {
+    len = room;
+    b->overflow = true;
+  }
+  memcpy(b->buf + b->len, s, len);
+  b->len += len;
+}
+
+
+
+static inline void put_str(MessageBuilder *b, const char *s) {
+  message_build_raw(b, s, strlen(s));
+}
+
+
+
+void message_build_prefix(MessageBuilder *b, const char *nick, const char *user, const char *host) {
+  message_build_raw(b, ":", 1);
+  if(nick) {
+    put_str(b, nick);
+    if(user) {
+      message_build_raw(b, "!", 1);
+      put_str(b, user);
+    }
+    if(host) message_build_raw(b, "@", 1);
+  }
+  if(host) put_str(b, host);
+  message_build_raw(b, " ", 1);
+}
+
+
+
+void message_build_command(MessageBuilder *b, const char *command) {
+  put_str(b, command);
+}
+
+
+
+void message_build_param(MessageBuilder *b, const char *s, size_t len) {
+  message_build_raw(b, " ", 1);
+  message_build_raw(b, s, len);
+}
+
+
+
+void message_build_trailing(MessageBuilder *b, const char *s, size_t len) {
+  message_build_raw(b, " :", 2);
+  message_build_raw(b, s, len);
+}
+
+
+
+size_t message_build_end(MessageBuilder *b) {
+  memcpy(b->buf + b->len, "\r\n", 2);
+  return b->len += 2;
+}
+
+
+
+static void build_escaped(MessageBuilder *b, const char *s, size_t len) {
+  size_t run = 0;
+  for(size_t i = 0; i < len; i++) {
+    const char *e;
+    switch(s[i]) {
+    case ';': e = "\\:"; break;
+    case ' ': e = "\\s"; break;
+    case '\\': e = "\\\\"; break;
+    case '\r': e = "\\r"; break;
+    case '\n': e = "\\n"; break;
+    default: continue;
+    }
+    message_build_raw(b, s + run, i - run);
+    message_build_raw(b, e, 2);
+    run = i + 1;
+  }
+  message_build_raw(b, s + run, len - run);
+}
+
+
+
+bool message_tostring(Message *m, char *dst, size_t n, size_t *len) {
+  if(!m->valid || !m->command) {
+    dst[0] = '\0';
+    if(len) *len = 0;
+    return false;
+  }
+
+  MessageBuilder b;
+  message_build_init(&b, dst, n);
+
+  if(!m->tags_split && m->raw_tags) {
+    message_build_raw(&b, "@", 1);
+    message_build_raw(&b, m->raw_tags, m->raw_tags_len);
+    message_build_raw(&b, " ", 1);
+  } else if(m->num_tags > 0) {
+    message_build_raw(&b, "@", 1);
+    for(size_t i = 0; i < m->num_tags; i++) {
+      if(i > 0) message_build_raw(&b, ";", 1);
+      message_build_raw(&b, m->tags[i].key, m->tags[i].key_len);
+      if(!m->tags[i].value_len) continue;
+      message_build_raw(&b, "=", 1);
+      if(m->tags_unescaped & (1ull << i)) {
+        build_escaped(&b, m->tags[i].value, m->tags[i].value_len);
+      } else {
+        message_build_raw(&b, m->tags[i].value, m->tags[i].value_len);
+      }
+    }
+    message_build_raw(&b, " ", 1);
+  }
+
+  if(m->prefix.nick || m->prefix.host) {
+    message_build_prefix(&b, m->prefix.nick, m->prefix.user, m->prefix.host);
+  }
+  message_build_command(&b, m->command);
+
+  for(size_t i = 0; i < m->num_args; i++) {
+    const char *arg = m->args[i];
+    size_t arg_len = m->args_len[i];
+    if(i == m->num_args - 1 && (!arg_len || *arg == ':' || memchr(arg, ' ', arg_len))) {
+      message_build_trailing(&b, arg, arg_len);
+    } else {
+      message_build_param(&b, arg, arg_len);
+    }
+  }
+
+  dst[b.len] = '\0';
+  if(len) *len = b.len;
+  return !b.overflow;
+}
+
+
+
 static bool validate(pcre2_code **regex, PCRE2_SPTR pattern, char *subject) {
   if(!*regex) {
     *regex = compile(pattern);
@@ -350,20 +737,26 @@ bool message_is_channel_valid(char *chan) {
 
 
 void message_free(Message *m) {
-  for(int i = 0; i < MESSAGE_MAX_TAGS; i++) {
-    free(m->tags[i].key);
-    free(m->tags[i].value);
-  }
+  if(m->owned) {
+    for(int i = 0; i < m->num_tags; i++) {
+      free(m->tags[i].key);
+      free(m->tags[i].value);
+    }
 
-  free(m->prefix.nick);
-  free(m->prefix.user);
-  free(m->prefix.host);
+    free(m->prefix.nick);
+    free(m->prefix.user);
+    free(m->prefix.host);
 
-  free(m->command);
-  for(int i = 0; i < MESSAGE_MAX_ARGS; i++) {
-    free(m->args[i]);
+    free(m->command);
+    for(int i = 0; i < m->num_args; i++) {
+      free(m->args[i]);
+    }
   }
 
-  *m = (Message){};
+  m->valid = false;
+  m->owned = false;
+  m->num_tags = 0;
+  m->num_args = 0;
+  m->prefix.nick = m->prefix.user = m->prefix.host = NULL;
+  m->command = NULL;
 }
-
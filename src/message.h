@@ -2,17 +2,40 @@
 #define MESSAGE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
 
 #define MESSAGE_MAX_LEN  2048
 #define MESSAGE_MAX_ARGS 16
 #define MESSAGE_MAX_TAGS 64
+#define MESSAGE_TAG_SLOTS 128 // Tag index size, a power of two
 
+// Every field is a pointer+length slice. Messages produced by
+// message_parse() point into the caller's buffer, which is terminated in
+// place at each field boundary, so fields are also valid C strings. Only
+// message_new_pcre2() without an arena allocates (owned = true). Slots past
+// num_tags and num_args are left unspecified.
+//
+// message_parse() leaves the tag section raw. message_tags() splits it into
+// tags[], and message_get_tag() also indexes the keys, so lines whose tags
+// are never read pay nothing for them. Values are stored as sent and only
+// unescaped when read through message_get_tag().
 typedef struct {
   bool valid;
+  bool owned;
+
+  char *raw_tags; // Tag section without the '@', until split
+  size_t raw_tags_len;
+  bool tags_split;
+  bool tags_indexed;
+  uint64_t tags_unescaped; // Bit i set once tags[i].value is unescaped
+  uint8_t tag_index[MESSAGE_TAG_SLOTS]; // Tag number + 1 by key hash, or 0
 
   struct {
     char *key;
     char *value;
+    size_t key_len;
+    size_t value_len;
   } tags[MESSAGE_MAX_TAGS];
   size_t num_tags;
 
@@ -20,19 +43,73 @@ typedef struct {
     char *nick;
     char *user;
     char *host;
+    size_t nick_len;
+    size_t user_len;
+    size_t host_len;
   } prefix;
 
   char *command;
+  size_t command_len;
+
   char *args[MESSAGE_MAX_ARGS];
+  size_t args_len[MESSAGE_MAX_ARGS];
   size_t num_args;
 } Message;
 
 void replace(char **old, char *new);
 
+// Parse s[0..len) in place. A trailing "\r\n" or "\n" is optional and
+// s[len] must be writable. No allocation is performed.
+bool message_parse(Message *m, char *s, size_t len);
 Message message_new(char *s);
-bool message_tostring(Message *m, char *dst, size_t n);
+
+// Parse every complete line in buf[0..len) in place into out[0..cap), with
+// no allocation and no per-line setup. Blank lines are skipped; malformed
+// ones still take a slot, with valid false. Returns the number of messages
+// and sets *used to where parsing stopped: the start of a trailing partial
+// line, or of the first line that didn't fit in out.
+size_t message_parse_batch(char *buf, size_t len, Message *out, size_t cap, size_t *used);
+
+// Reference parser built on the PCRE2 grammar. Copies every field into
+// arena, or into separate allocations if arena is NULL.
+Message message_new_pcre2(char *s, Arena *arena);
+
+// Serialize m into dst[0..n), NUL-terminated and without a line ending.
+// *len gets the exact length written. Returns false if the line was cut to
+// fit, or if m didn't parse or has no command; dst is then empty. n must be
+// at least 2.
+bool message_tostring(Message *m, char *dst, size_t n, size_t *len);
+
+// Split the tag section if that hasn't happened yet. Returns num_tags.
+size_t message_tags(Message *m);
+
+// Unescaped value of the tag called key, or NULL if there is none. A tag
+// without a value reads as "". The value is unescaped in place.
+const char *message_get_tag(Message *m, const char *key, size_t *len);
 void message_free(Message *m);
 
+// Writes one outgoing line straight into buf: an optional prefix, the
+// command, middle params and an optional trailing param, in that order.
+// Params are copied as given, so middle ones must not contain spaces.
+// Output that doesn't fit is cut and sets overflow, but the two bytes for
+// "\r\n" are always kept, so message_build_end() yields a whole line.
+typedef struct {
+  char *buf;
+  size_t cap;
+  size_t len;
+  bool overflow;
+} MessageBuilder;
+
+void message_build_init(MessageBuilder *b, char *buf, size_t cap);
+void message_build_raw(MessageBuilder *b, const char *s, size_t len);
+// Writes ":nick!user@host ". Any part may be NULL.
+void message_build_prefix(MessageBuilder *b, const char *nick, const char *user, const char *host);
+void message_build_command(MessageBuilder *b, const char *command);
+void message_build_param(MessageBuilder *b, const char *s, size_t len);
+void message_build_trailing(MessageBuilder *b, const char *s, size_t len);
+// Append "\r\n" and return the length of the line
+size_t message_build_end(MessageBuilder *b);
+
 bool message_is_nick_valid(char *nick);
 bool message_is_channel_valid(char *chan);
 
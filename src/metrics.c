@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+
+_Thread_local Metrics metrics;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Metrics *registered;
+
+
+
+void metrics_register(void) {
+  pthread_mutex_lock(&lock);
+  metrics.next = registered;
+  registered = &metrics;
+  pthread_mutex_unlock(&lock);
+}
+
+
+
+static inline uint64_t load(const _Atomic uint64_t *c) {
+  return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+
+
+static void hist_add(Histogram *to, const Histogram *from) {
+  for(size_t i = 0; i < HIST_BUCKETS; i++) {
+    metric_add(&to->buckets[i], load(&from->buckets[i]));
+  }
+  metric_add(&to->count, load(&from->count));
+  metric_add(&to->sum, load(&from->sum));
+  if(load(&from->max) > load(&to->max)) {
+    atomic_store_explicit(&to->max, load(&from->max), memory_order_relaxed);
+  }
+}
+
+
+
+void metrics_sum(Metrics *out) {
+  memset(out, 0, sizeof(*out));
+
+  pthread_mutex_lock(&lock);
+  for(Metrics *m = registered; m; m = m->next) {
+#define X(n) metric_add(&out->n, load(&m->n));
+    METRICS_COUNTERS
+#undef X
+    for(size_t i = 0; i < METRICS_COMMANDS; i++) {
+      metric_add(&out->commands[i], load(&m->commands[i]));
+    }
+#define X(n) hist_add(&out->n, &m->n);
+    METRICS_HISTOGRAMS
+#undef X
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+
+
+uint64_t metrics_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+// Values below 2 * HIST_SUB have a bucket each. Above that, the top bit
+// picks a group and the next HIST_SUB_BITS bits the bucket within it.
+#define HIST_SUB (1 << HIST_SUB_BITS)
+
+static size_t bucket_of(uint64_t v) {
+  if(v < 2 * HIST_SUB) return v;
+  int msb = 63 - __builtin_clzll(v);
+  size_t i = (size_t)(msb - HIST_SUB_BITS + 1) * HIST_SUB +
+    ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+  return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+
+
+// Upper bound of bucket i
+static uint64_t bucket_max(size_t i) {
+  if(i < 2 * HIST_SUB) return i;
+  int msb = i / HIST_SUB + HIST_SUB_BITS - 1;
+  uint64_t low = (uint64_t)(HIST_SUB + i % HIST_SUB) << (msb - HIST_SUB_BITS);
+  return low + (1ull << (msb - HIST_SUB_BITS)) - 1;
+}
+
+
+
+void hist_record(Histogram *h, uint64_t v) {
+  metric_add(&h->buckets[bucket_of(v)], 1);
+  metric_add(&h->count, 1);
+  metric_add(&h->sum, v);
+  if(v > load(&h->max)) atomic_store_explicit(&h->max, v, memory_order_relaxed);
+}
+
+
+
+uint64_t hist_percentile(const Histogram *h, double p) {
+  uint64_t count = load(&h->count);
+  if(!count) return 0;
+
+  uint64_t want = p * count;
+  if(want < 1) want = 1;
+  uint64_t seen = 0;
+  for(size_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += load(&h->buckets[i]);
+    if(seen >= want) {
+      uint64_t max = load(&h->max);
+      return bucket_max(i) < max ? bucket_max(i) : max;
+    }
+  }
+  return load(&h->max);
+}
@@ -0,0 +1,79 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Always-on counters and histograms. Each thread only writes its own
+// Metrics, so updates are a plain load and store; readers on other threads
+// sum every registered thread's copy with relaxed loads and may see a
+// slightly stale total, but never a torn one.
+
+#define METRICS_COUNTERS \
+X(lines_in) \
+X(lines_out) \
+X(bytes_in) \
+X(bytes_out) \
+X(parse_failures) \
+X(unknown_commands) \
+X(slow_consumers)
+
+// Latencies are in ns: parsing a line, running its command, and from output
+// being queued on an idle connection to the queue draining. fanout is the
+// number of local recipients of each channel message.
+#define METRICS_HISTOGRAMS \
+X(parse_ns) \
+X(dispatch_ns) \
+X(flush_ns) \
+X(fanout)
+
+#define METRICS_COMMANDS 32 // Per-command slots; callers pick the index
+
+// Log-linear buckets as in HDR histograms: 16 per power of two, so a
+// bucket's bounds are within 1/16 of each other
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (48 << HIST_SUB_BITS)
+
+typedef struct {
+  _Atomic uint64_t buckets[HIST_BUCKETS];
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+} Histogram;
+
+typedef struct Metrics {
+#define X(n) _Atomic uint64_t n;
+  METRICS_COUNTERS
+#undef X
+  _Atomic uint64_t commands[METRICS_COMMANDS];
+#define X(n) Histogram n;
+  METRICS_HISTOGRAMS
+#undef X
+  struct Metrics *next;
+} Metrics;
+
+// This thread's metrics. Threads that want theirs reported call
+// metrics_register() once, and must then run for as long as the process.
+extern _Thread_local Metrics metrics;
+void metrics_register(void);
+
+// Sum every registered thread into out
+void metrics_sum(Metrics *out);
+
+// CLOCK_MONOTONIC in ns
+uint64_t metrics_now(void);
+
+// Single-writer update of a counter owned by this thread
+static inline void metric_add(_Atomic uint64_t *c, uint64_t n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+      memory_order_relaxed);
+}
+
+void hist_record(Histogram *h, uint64_t v);
+// Smallest bucket bound with at least fraction p of the values at or
+// below it, or 0 if h is empty
+uint64_t hist_percentile(const Histogram *h, double p);
+
+#endif
@@ -0,0 +1,30 @@
+#include <stddef.h>
+#include "mpsc.h"
+
+
+
+bool mpsc_push(Mpsc *q, MpscNode *n) {
+  MpscNode *head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  do {
+    n->next = head;
+  } while(!atomic_compare_exchange_weak_explicit(
+        &q->head, &head, n,
+        memory_order_release, memory_order_relaxed));
+  return head == NULL;
+}
+
+
+
+MpscNode *mpsc_take(Mpsc *q) {
+  MpscNode *n = atomic_exchange_explicit(&q->head, NULL, memory_order_acquire);
+
+  // The stack comes out newest first
+  MpscNode *fifo = NULL;
+  while(n) {
+    MpscNode *next = n->next;
+    n->next = fifo;
+    fifo = n;
+    n = next;
+  }
+  return fifo;
+}
@@ -0,0 +1,24 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Lock-free multi-producer, single-consumer queue of intrusive nodes.
+// Producers push with a CAS; the consumer takes the whole queue at once, so
+// there is no ABA hazard and per-producer order is preserved.
+typedef struct MpscNode {
+  struct MpscNode *next;
+} MpscNode;
+
+typedef struct {
+  _Atomic(MpscNode *) head;
+} Mpsc;
+
+// Returns true if the queue was empty, i.e. the consumer may need a wakeup
+bool mpsc_push(Mpsc *q, MpscNode *n);
+
+// Detach every queued node, oldest first
+MpscNode *mpsc_take(Mpsc *q);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include "nick.h"
+
+#define INITIAL_CAP 256
+
+
+
+// Slot holding key, or the empty slot where it would go
+static NickEntry *probe(NickTable *t, const Atom *key) {
+  size_t mask = t->cap - 1;
+  for(size_t i = key->hash & mask;; i = (i + 1) & mask) {
+    NickEntry *e = &t->entries[i];
+    if(!e->key || e->key == key) return e;
+  }
+}
+
+
+
+void *nick_find(NickTable *t, const Atom *nick) {
+  if(!t->cap) return NULL;
+  NickEntry *e = probe(t, nick->key);
+  return e->key ? e->owner : NULL;
+}
+
+
+
+static bool grow(NickTable *t) {
+  size_t cap = t->cap ? t->cap * 2 : INITIAL_CAP;
+  NickEntry *entries = calloc(cap, sizeof(NickEntry));
+  if(!entries) return false;
+
+  NickTable bigger = { .entries = entries, .cap = cap, .count = t->count };
+  for(size_t i = 0; i < t->cap; i++) {
+    if(t->entries[i].key) *probe(&bigger, t->entries[i].key) = t->entries[i];
+  }
+
+  free(t->entries);
+  *t = bigger;
+  return true;
+}
+
+
+
+bool nick_add(NickTable *t, const Atom *nick, void *owner) {
+  // Keep the load factor under 1/2 so probes stay short
+  if((t->count + 1) * 2 > t->cap && !grow(t)) return false;
+
+  NickEntry *e = probe(t, nick->key);
+  if(e->key) return false;
+
+  *e = (NickEntry){ .key = nick->key, .owner = owner };
+  t->count++;
+  return true;
+}
+
+
+
+// Backward-shift deletion, so lookups never need tombstones
+void nick_remove(NickTable *t, const Atom *nick) {
+  if(!t->cap) return;
+
+  size_t mask = t->cap - 1;
+  NickEntry *e = probe(t, nick->key);
+  if(!e->key) return;
+
+  size_t hole = e - t->entries;
+  for(size_t i = (hole + 1) & mask; t->entries[i].key; i = (i + 1) & mask) {
+    size_t home = t->entries[i].key->hash & mask;
+    // Move the entry back if the hole lies between its home and its slot
+    if(((i - home) & mask) >= ((i - hole) & mask)) {
+      t->entries[hole] = t->entries[i];
+      hole = i;
+    }
+  }
+
+  t->entries[hole] = (NickEntry){};
+  t->count--;
+}
@@ -0,0 +1,26 @@
+#ifndef NICK_H
+#define NICK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "atom.h"
+
+// Registry of nicks in use, compared under RFC 1459 case mapping by way of
+// their atoms' keys. Atoms are borrowed: whoever registers a nick must hold
+// a reference to it until it is removed.
+typedef struct {
+  Atom *key; // NULL when the slot is empty
+  void *owner;
+} NickEntry;
+
+typedef struct {
+  NickEntry *entries;
+  size_t cap; // Power of two
+  size_t count;
+} NickTable;
+
+void *nick_find(NickTable *t, const Atom *nick);
+bool nick_add(NickTable *t, const Atom *nick, void *owner);
+void nick_remove(NickTable *t, const Atom *nick);
+
+#endif
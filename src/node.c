@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "node.h"
+
+static const struct {
+  const char *name;
+  const char *description;
+} types[NUM_NODE_TYPES] = {
+#include "nodes/__names.z"
+};
+
+
+
+int node_type_named(const char *name, size_t len) {
+  for(int i = 1; i < NUM_NODE_TYPES; i++) {
+    if(strlen(types[i].name) == len && !strncasecmp(types[i].name, name, len)) return i;
+  }
+  return NODE_NONE;
+}
+
+
+
+const char *node_type_name(int type) {
+  return type > NODE_NONE && type < NUM_NODE_TYPES ? types[type].name : NULL;
+}
+
+
+
+const char *node_type_description(int type) {
+  return type > NODE_NONE && type < NUM_NODE_TYPES ? types[type].description : NULL;
+}
+
+
+
+void node_store_init(NodeStore *nodes) {
+  memset(nodes, 0, sizeof(*nodes));
+}
+
+
+
+void node_store_free(NodeStore *nodes) {
+  free(nodes->types);
+  free(nodes->slots);
+  free(nodes->pass);
+  free(nodes->fail);
+  free(nodes->names);
+  free(nodes->name_index);
+  arena_free(&nodes->name_arena);
+#include "nodes/__pools_free.z"
+  memset(nodes, 0, sizeof(*nodes));
+}
+
+
+
+static bool resize(void **items, uint32_t n, size_t size) {
+  void *p = realloc(*items, (size_t)n * size);
+  if(!p) return false;
+  *items = p;
+  return true;
+}
+
+
+
+// Grow *items to hold at least n of size bytes each
+static bool pool_reserve(void **items, uint32_t *cap, uint32_t n, size_t size) {
+  if(n <= *cap || !size) return true;
+
+  uint32_t c = *cap ? *cap * 2 : 64;
+  while(c < n) c *= 2;
+  if(!resize(items, c, size)) return false;
+  *cap = c;
+  return true;
+}
+
+
+
+static uint32_t name_hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < len; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+  return h;
+}
+
+
+
+// Slot of name in the index, which is either empty or holds that name
+static uint32_t *name_slot(const NodeStore *nodes, const char *name, size_t len) {
+  uint32_t mask = nodes->name_index_cap - 1;
+  for(uint32_t i = name_hash(name, len) & mask;; i = (i + 1) & mask) {
+    uint32_t *slot = &nodes->name_index[i];
+    if(!*slot) return slot;
+    const char *s = nodes->names[*slot - 1];
+    if(!strncmp(s, name, len) && !s[len]) return slot;
+  }
+}
+
+
+
+// Keep the name index at most half full
+static bool name_index_reserve(NodeStore *nodes) {
+  if((nodes->num_named + 1) * 2 <= nodes->name_index_cap) return true;
+
+  uint32_t *old = nodes->name_index;
+  uint32_t old_cap = nodes->name_index_cap;
+  uint32_t cap = old_cap ? old_cap * 2 : 64;
+  if(!(nodes->name_index = calloc(cap, sizeof(uint32_t)))) {
+    nodes->name_index = old;
+    return false;
+  }
+  nodes->name_index_cap = cap;
+
+  for(uint32_t i = 0; i < old_cap; i++) {
+    if(!old[i]) continue;
+    const char *name = nodes->names[old[i] - 1];
+    *name_slot(nodes, name, strlen(name)) = old[i];
+  }
+  free(old);
+  return true;
+}
+
+
+
+int node_store_find(const NodeStore *nodes, const char *name, size_t len) {
+  if(!nodes->num_named) return -1;
+  return (int)*name_slot(nodes, name, len) - 1;
+}
+
+
+
+int node_store_add(NodeStore *nodes, int type, const char *name, size_t len) {
+  if(!node_type_name(type) || (name && node_store_find(nodes, name, len) >= 0)) return -1;
+
+  uint32_t id = nodes->num_nodes;
+  if(id == INT32_MAX) return -1;
+  if(id == nodes->cap) {
+    uint32_t cap = nodes->cap ? nodes->cap * 2 : 64;
+    if(!resize((void **)&nodes->types, cap, sizeof(*nodes->types)) ||
+        !resize((void **)&nodes->slots, cap, sizeof(*nodes->slots)) ||
+        !resize((void **)&nodes->pass, cap, sizeof(*nodes->pass)) ||
+        !resize((void **)&nodes->fail, cap, sizeof(*nodes->fail)) ||
+        !resize((void **)&nodes->names, cap, sizeof(*nodes->names))) {
+      return -1;
+    }
+    nodes->cap = cap;
+  }
+
+  const char *interned = NULL;
+  if(name) {
+    if(!name_index_reserve(nodes) || !(interned = arena_strndup(&nodes->name_arena, name, len))) {
+      return -1;
+    }
+  }
+
+  uint32_t slot = 0;
+  switch(type) {
+#include "nodes/__add.z"
+  }
+
+  nodes->types[id] = type;
+  nodes->slots[id] = slot;
+  nodes->pass[id] = id + 1;
+  nodes->fail[id] = -1;
+  nodes->names[id] = interned;
+  if(interned) {
+    *name_slot(nodes, interned, len) = id + 1;
+    nodes->num_named++;
+  }
+  nodes->num_nodes++;
+  return id;
+}
+
+
+
+static bool node_set_text(char *dst, size_t *dst_len, const char *value, size_t len) {
+  if(len >= NODE_TEXT_MAX) return false;
+  memcpy(dst, value, len);
+  dst[len] = 0;
+  *dst_len = len;
+  return true;
+}
+
+
+
+static bool node_set_uint(uint64_t *dst, const char *value, size_t len) {
+  char s[24];
+  if(!len || len >= sizeof(s)) return false;
+  memcpy(s, value, len);
+  s[len] = 0;
+
+  char *end;
+  unsigned long long v = strtoull(s, &end, 10);
+  if(*end || s[0] == '-') return false;
+  *dst = v;
+  return true;
+}
+
+
+
+bool node_set(NodeStore *nodes, int id, const char *key, const char *value, size_t len) {
+  if(id < 0 || id >= nodes->num_nodes) return false;
+  switch(nodes->types[id]) {
+#include "nodes/__fields.z"
+  }
+  return false;
+}
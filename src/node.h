@@ -1,16 +1,73 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "ratelimit.h"
+
+// Node types are declared in nodes/*.x. Each declares its settable fields,
+// XTEXT(name) for text and XUINT(name) for numbers, plus any XSTATE() it
+// keeps, and optionally:
+//   XSETUP(...)  run once before the first message; sets ok = false to fail
+//   XFREE(...)   release what XSETUP acquired
+//   XRUN(...)    run per message with self, item and p (the Pipeline) in
+//                scope; sets pass = false to take the node's fail edge
+// The .y files expand these into the types below and into the switches the
+// pipeline dispatches through.
+
+#define NODE_TEXT_MAX 128
+
 #include "nodes/__types.z"
 #include "nodes/__symbols.z"
-#include "nodes/__union.z"
 
 #define MAX_NAME_LEN 64
 
+// A graph's nodes, stored by column. A node is an index into the arrays
+// below; what a walk reads, its type, pool slot and edges, sits in dense
+// arrays of its own, and each type's fields live in a pool of just that
+// type. Names are kept apart in an arena with their own index, as only
+// building and reporting look at them. Arrays and pools grow by doubling,
+// so adding a node rarely allocates.
 typedef struct {
-  char name[MAX_NAME_LEN];
-  int type;
-  NodeUnion node_union;
-} Node;
+  uint32_t num_nodes;
+  uint32_t cap;
+  uint8_t *types;
+  uint32_t *slots; // Index into the pool for the node's type
+  int32_t *pass;   // Next node for messages that pass, or -1
+  int32_t *fail;   // And for those that don't
+
+  const char **names; // NULL for unnamed nodes
+  Arena name_arena;
+  uint32_t *name_index; // Node + 1 by name hash, or 0
+  uint32_t name_index_cap;
+  uint32_t num_named;
+
+#include "nodes/__pools.z"
+} NodeStore;
+
+// Fields of node id, whose type's XIDNAME is type
+#define NODE_AT(nodes, id, type) (&(nodes)->type.items[(nodes)->slots[id]])
+
+void node_store_init(NodeStore *nodes);
+void node_store_free(NodeStore *nodes);
+
+// Append a node with zeroed fields, its pass edge going to the next node to
+// be added and its fail edge nowhere. name may be NULL. Returns the node,
+// or -1 if type is unknown, the name is taken or memory ran out.
+int node_store_add(NodeStore *nodes, int type, const char *name, size_t len);
+
+// Node called name, or -1
+int node_store_find(const NodeStore *nodes, const char *name, size_t len);
+
+// Type called name, or NODE_NONE
+int node_type_named(const char *name, size_t len);
+const char *node_type_name(int type);
+const char *node_type_description(int type);
+
+// Set the field called key of node id from value[0..len). Returns false if
+// the type has no such field or the value doesn't fit it.
+bool node_set(NodeStore *nodes, int id, const char *key, const char *value, size_t len);
 
 #endif
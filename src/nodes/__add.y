@@ -0,0 +1,11 @@
+#include "../macro_magic.h"
+
+// Cases of the switch in node_store_add(), each taking a zeroed slot
+#define XSTART() \
+case P(NODE_,XSYMNAME): \
+  if(!pool_reserve((void **)&nodes->XIDNAME.items, &nodes->XIDNAME.cap, \
+      nodes->XIDNAME.len + 1, sizeof(*nodes->XIDNAME.items))) return -1; \
+  slot = nodes->XIDNAME.len++; \
+  memset(&nodes->XIDNAME.items[slot], 0, sizeof(*nodes->XIDNAME.items)); \
+  break;
+#include "_all.x"
@@ -0,0 +1,15 @@
+#include "../macro_magic.h"
+
+// Cases of the switch in node_set()
+#define XSTART() \
+case P(NODE_,XSYMNAME): { \
+  P(Node,XTYPENAME) *self = NODE_AT(nodes, id, XIDNAME); \
+  (void)self;
+#define XTEXT(n) \
+  if(!strcmp(key, #n)) return node_set_text(self->n, &self->P(n,_len), value, len);
+#define XUINT(n) \
+  if(!strcmp(key, #n)) return node_set_uint(&self->n, value, len);
+#define XEND() \
+  break; \
+}
+#include "_all.x"
@@ -0,0 +1,4 @@
+#include "../macro_magic.h"
+
+#define XSTART() [P(NODE_,XSYMNAME)] = { PS(XIDNAME), XDESCRIPTION },
+#include "_all.x"
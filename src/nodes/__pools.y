@@ -0,0 +1,4 @@
+#include "../macro_magic.h"
+
+#define XSTART() struct { P(Node,XTYPENAME) *items; uint32_t len; uint32_t cap; } XIDNAME;
+#include "_all.x"
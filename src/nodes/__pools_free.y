@@ -0,0 +1,4 @@
+#include "../macro_magic.h"
+
+#define XSTART() free(nodes->XIDNAME.items);
+#include "_all.x"
@@ -0,0 +1,16 @@
+#include "../macro_magic.h"
+
+// Cases of the switch in pipeline_run_node(), each looping over the batch
+#define XRUN(...) \
+case P(NODE_,XSYMNAME): { \
+  P(Node,XTYPENAME) *self = NODE_AT(nodes, id, XIDNAME); \
+  for(size_t k = 0; k < n; k++) { \
+    PipeItem *item = &p->items[in[k]]; \
+    (void)item; \
+    bool pass = true; \
+    __VA_ARGS__ \
+    pipeline_route(p, id, in[k], pass); \
+  } \
+  break; \
+}
+#include "_all.x"
@@ -0,0 +1,9 @@
+#include "../macro_magic.h"
+
+#define XSETUP(...) \
+case P(NODE_,XSYMNAME): { \
+  P(Node,XTYPENAME) *self = NODE_AT(nodes, id, XIDNAME); \
+  __VA_ARGS__ \
+  break; \
+}
+#include "_all.x"
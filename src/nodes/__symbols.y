@@ -1,7 +1,8 @@
-#include "../magic.h"
+#include "../macro_magic.h"
 
 enum {
 NODE_NONE = 0,
 #define XSTART() P(NODE_,XSYMNAME),
 #include "_all.x"
+NUM_NODE_TYPES
 };
@@ -1,5 +1,8 @@
-#include "../magic.h"
+#include "../macro_magic.h"
 
 #define XSTART() typedef struct {
+#define XTEXT(n) char n[NODE_TEXT_MAX]; size_t P(n,_len);
+#define XUINT(n) uint64_t n;
+#define XSTATE(...) __VA_ARGS__
 #define XEND() } P(Node,XTYPENAME);
 #include "_all.x"
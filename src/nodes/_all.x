@@ -1,3 +1,8 @@
 #include "_default.x"
 #include "empty.x"
+#include "filter.x"
+#include "match.x"
+#include "transform.x"
+#include "reply.x"
+#include "ratelimit.x"
 #include "_reset.x"
@@ -6,3 +6,27 @@
 #define XEND(...)
 #endif
 
+#ifndef XTEXT
+#define XTEXT(...)
+#endif
+
+#ifndef XUINT
+#define XUINT(...)
+#endif
+
+#ifndef XSTATE
+#define XSTATE(...)
+#endif
+
+#ifndef XRUN
+#define XRUN(...)
+#endif
+
+#ifndef XSETUP
+#define XSETUP(...)
+#endif
+
+#ifndef XFREE
+#define XFREE(...)
+#endif
+
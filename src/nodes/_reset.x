@@ -5,3 +5,27 @@
 #ifdef XEND
 #undef XEND
 #endif
+
+#ifdef XTEXT
+#undef XTEXT
+#endif
+
+#ifdef XUINT
+#undef XUINT
+#endif
+
+#ifdef XSTATE
+#undef XSTATE
+#endif
+
+#ifdef XRUN
+#undef XRUN
+#endif
+
+#ifdef XSETUP
+#undef XSETUP
+#endif
+
+#ifdef XFREE
+#undef XFREE
+#endif
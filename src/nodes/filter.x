@@ -0,0 +1,19 @@
+#include "_before.x"
+#define XTYPENAME Filter
+#define XSYMNAME FILTER
+#define XIDNAME filter
+#define XDESCRIPTION "Pass messages with the given command and sender"
+
+XSTART()
+XTEXT(command)
+XTEXT(nick)
+XEND()
+
+XRUN(
+  if(self->command_len && (item->command_len != self->command_len ||
+      strncasecmp(item->command, self->command, self->command_len))) pass = false;
+  if(self->nick_len && (item->nick_len != self->nick_len ||
+      strncasecmp(item->nick, self->nick, self->nick_len))) pass = false;
+)
+#include "_after.x"
+
@@ -0,0 +1,19 @@
+#include "_before.x"
+#define XTYPENAME Match
+#define XSYMNAME MATCH
+#define XIDNAME match
+#define XDESCRIPTION "Pass messages whose text starts with, or contains, the given text"
+
+XSTART()
+XTEXT(prefix)
+XTEXT(contains)
+XEND()
+
+XRUN(
+  if(item->text_len < self->prefix_len ||
+      strncasecmp(item->text, self->prefix, self->prefix_len)) pass = false;
+  if(self->contains_len &&
+      !memmem(item->text, item->text_len, self->contains, self->contains_len)) pass = false;
+)
+#include "_after.x"
+
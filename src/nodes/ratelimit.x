@@ -0,0 +1,26 @@
+#include "_before.x"
+#define XTYPENAME Ratelimit
+#define XSYMNAME RATELIMIT
+#define XIDNAME ratelimit
+#define XDESCRIPTION "Pass at most limit messages in any period_ms"
+
+XSTART()
+XUINT(limit)
+XUINT(period_ms)
+XSTATE(TokenBucket bucket;)
+XEND()
+
+XSETUP(
+  ok = bucket_init(&self->bucket, self->limit ? self->limit : 1, self->period_ms * 1000000);
+)
+
+XFREE(
+  bucket_free(&self->bucket);
+)
+
+XRUN(
+  if(bucket_available(&self->bucket, p->now)) bucket_take(&self->bucket, 1, p->now);
+  else pass = false;
+)
+#include "_after.x"
+
@@ -0,0 +1,16 @@
+#include "_before.x"
+#define XTYPENAME Reply
+#define XSYMNAME REPLY
+#define XIDNAME reply
+#define XDESCRIPTION "Answer where the message came from with the given text, then the message text if echo is set"
+
+XSTART()
+XTEXT(text)
+XUINT(echo)
+XEND()
+
+XRUN(
+  pipeline_reply(p, item, self->text, self->text_len, self->echo);
+)
+#include "_after.x"
+
@@ -0,0 +1,28 @@
+#include "_before.x"
+#define XTYPENAME Transform
+#define XSYMNAME TRANSFORM
+#define XIDNAME transform
+#define XDESCRIPTION "Drop leading bytes of the text, trim it and change its case, in place"
+
+XSTART()
+XUINT(skip)
+XUINT(trim)
+XUINT(upper)
+XUINT(lower)
+XEND()
+
+XRUN(
+  size_t skip = self->skip < item->text_len ? self->skip : item->text_len;
+  item->text += skip;
+  item->text_len -= skip;
+  if(self->trim) {
+    while(item->text_len && item->text[0] == ' ') item->text++, item->text_len--;
+    while(item->text_len && item->text[item->text_len - 1] == ' ') item->text_len--;
+  }
+  for(size_t i = 0; (self->upper || self->lower) && i < item->text_len; i++) {
+    unsigned char c = item->text[i];
+    item->text[i] = self->upper ? toupper(c) : tolower(c);
+  }
+)
+#include "_after.x"
+
@@ -0,0 +1,47 @@
+#include <string.h>
+#include <strings.h>
+#include "phash.h"
+
+#define MAX_SEEDS 100000
+
+
+
+// FNV-1a over the bytes with bit 5 cleared, which upper-cases letters. It
+// also folds some punctuation together, which the final compare sorts out.
+static uint32_t hash(uint32_t seed, const char *s, size_t len) {
+  uint32_t h = 2166136261u ^ seed;
+  for(size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i] & ~0x20;
+    h *= 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+
+
+bool phash_build(PHash *h, const char *const *keys, size_t num_keys) {
+  if(num_keys >= PHASH_SLOTS / 2 || num_keys > UINT8_MAX - 1) return false;
+
+  h->keys = keys;
+  h->num_keys = num_keys;
+  for(h->seed = 0; h->seed < MAX_SEEDS; h->seed++) {
+    memset(h->slots, 0, sizeof(h->slots));
+
+    size_t i = 0;
+    for(; i < num_keys; i++) {
+      uint8_t *slot = &h->slots[hash(h->seed, keys[i], strlen(keys[i])) & (PHASH_SLOTS - 1)];
+      if(*slot) break;
+      *slot = i + 1;
+    }
+    if(i == num_keys) return true;
+  }
+  return false;
+}
+
+
+
+int phash_find(const PHash *h, const char *s, size_t len) {
+  int i = h->slots[hash(h->seed, s, len) & (PHASH_SLOTS - 1)] - 1;
+  if(i < 0 || strncasecmp(h->keys[i], s, len) || h->keys[i][len]) return -1;
+  return i;
+}
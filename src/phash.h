@@ -0,0 +1,26 @@
+#ifndef PHASH_H
+#define PHASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHASH_SLOTS 128 // Power of two
+
+// Case-insensitive perfect hash over a fixed set of ASCII keys. Building
+// searches for a seed under which no two keys share a slot, so a lookup is
+// one hash and one comparison however many keys there are.
+typedef struct {
+  uint32_t seed;
+  const char *const *keys;
+  size_t num_keys;
+  uint8_t slots[PHASH_SLOTS]; // Key index + 1, or 0 if empty
+} PHash;
+
+// Returns false if there are too many keys or no seed separates them
+bool phash_build(PHash *h, const char *const *keys, size_t num_keys);
+
+// Index of the key equal to s[0..len) ignoring case, or -1
+int phash_find(const PHash *h, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "pipeline.h"
+#include "log.h"
+
+
+
+void pipeline_init(Pipeline *p, PipeEmit emit, void *arg) {
+  memset(p, 0, sizeof(*p));
+  node_store_init(&p->nodes);
+  p->emit = emit;
+  p->emit_arg = arg;
+}
+
+
+
+// Undo the setup of nodes [0, n)
+static void pipeline_teardown(Pipeline *p, uint32_t n) {
+  NodeStore *nodes = &p->nodes;
+  for(uint32_t id = 0; id < n; id++) {
+    switch(nodes->types[id]) {
+#include "nodes/__free.z"
+    }
+  }
+}
+
+
+
+void pipeline_free(Pipeline *p) {
+  if(p->started) pipeline_teardown(p, p->nodes.num_nodes);
+  node_store_free(&p->nodes);
+  free(p->head);
+  free(p->tail);
+  free(p->active);
+  pipeline_init(p, p->emit, p->emit_arg);
+}
+
+
+
+int pipeline_add(Pipeline *p, int type, const char *name) {
+  if(p->started) return -1;
+  return node_store_add(&p->nodes, type, name, name ? strlen(name) : 0);
+}
+
+
+
+bool pipeline_link(Pipeline *p, int from, int pass, int fail) {
+  int n = p->nodes.num_nodes;
+  if(p->started || from < 0 || from >= n) return false;
+  if((pass != -1 && (pass <= from || pass >= n)) || (fail != -1 && (fail <= from || fail >= n))) {
+    return false;
+  }
+  p->nodes.pass[from] = pass;
+  p->nodes.fail[from] = fail;
+  return true;
+}
+
+
+
+// Next space-separated word of s, or of a double-quoted value after '='.
+// Returns false at the end of the line.
+static bool next_word(const char **s, const char **word, size_t *len) {
+  while(**s == ' ' || **s == '\t') (*s)++;
+  if(!**s || **s == '\n' || **s == '#') return false;
+
+  *word = *s;
+  bool quoted = false;
+  while(**s && **s != '\n' && (quoted || (**s != ' ' && **s != '\t'))) {
+    if(**s == '"') quoted = !quoted;
+    (*s)++;
+  }
+  *len = *s - *word;
+  return true;
+}
+
+
+
+// Index of the edge target in word, -1 for "-", or -2 if there is none
+static int edge(const Pipeline *p, const char *word, size_t len) {
+  if(len == 1 && word[0] == '-') return -1;
+  int i = node_store_find(&p->nodes, word, len);
+  return i >= 0 ? i : -2;
+}
+
+
+
+bool pipeline_load(Pipeline *p, const char *spec, int *line) {
+  if(p->started) return false;
+  uint32_t first = p->nodes.num_nodes;
+
+  // Edges may name later nodes, so they are resolved in a second pass
+  for(int round = 0; round < 2; round++) {
+    const char *s = spec;
+    uint32_t id = first;
+    for(*line = 1; *s; (*line)++) {
+      const char *word;
+      size_t len;
+      if(!next_word(&s, &word, &len)) goto next;
+
+      const char *name = word;
+      size_t name_len = len;
+      if(name_len >= MAX_NAME_LEN || !next_word(&s, &word, &len)) return false;
+      if(round == 0 && node_store_add(&p->nodes, node_type_named(word, len), name, name_len) < 0) {
+        return false;
+      }
+      int pass_to = id + 1 < p->nodes.num_nodes ? id + 1 : -1;
+      int fail_to = -1;
+
+      while(next_word(&s, &word, &len)) {
+        if(word[0] == '>' || word[0] == '!') {
+          int *to = word[0] == '>' ? &pass_to : &fail_to;
+          if(len > 1) {
+            word++;
+            len--;
+          } else if(!next_word(&s, &word, &len)) {
+            return false;
+          }
+          if(round == 1 && (*to = edge(p, word, len)) == -2) return false;
+          continue;
+        }
+
+        const char *eq = memchr(word, '=', len);
+        if(!eq || round == 1) continue;
+        char key[32];
+        size_t key_len = eq - word;
+        const char *value = eq + 1;
+        size_t value_len = len - key_len - 1;
+        if(key_len >= sizeof(key)) return false;
+        memcpy(key, word, key_len);
+        key[key_len] = 0;
+        if(value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"') {
+          value++;
+          value_len -= 2;
+        }
+        if(!node_set(&p->nodes, id, key, value, value_len)) return false;
+      }
+
+      if(round == 1 && !pipeline_link(p, id, pass_to, fail_to)) return false;
+      id++;
+
+    next:
+      while(*s && *s != '\n') s++;
+      if(*s) s++;
+    }
+  }
+
+  *line = 0;
+  return true;
+}
+
+
+
+bool pipeline_start(Pipeline *p) {
+  if(p->started) return true;
+  NodeStore *nodes = &p->nodes;
+
+  free(p->head);
+  free(p->tail);
+  free(p->active);
+  p->active_words = (nodes->num_nodes + 63) / 64;
+  p->head = calloc(nodes->num_nodes, sizeof(uint16_t));
+  p->tail = calloc(nodes->num_nodes, sizeof(uint16_t));
+  p->active = calloc(p->active_words, sizeof(uint64_t));
+  if(!p->head || !p->tail || !p->active) return false;
+
+  for(uint32_t id = 0; id < nodes->num_nodes; id++) {
+    if(nodes->pass[id] >= (int32_t)nodes->num_nodes) nodes->pass[id] = -1;
+
+    bool ok = true;
+    switch(nodes->types[id]) {
+#include "nodes/__setup.z"
+    }
+    if(!ok) {
+      LOG(LOG_ERROR, "Could not set up pipeline node %s", nodes->names[id] ? nodes->names[id] : "");
+      pipeline_teardown(p, id);
+      return false;
+    }
+  }
+
+  p->started = true;
+  return true;
+}
+
+
+
+void pipeline_reply(Pipeline *p, const PipeItem *item, const char *text, size_t len, bool echo) {
+  if(!p->emit || !item->target) return;
+
+  size_t n = len < sizeof(p->reply) ? len : sizeof(p->reply) - 1;
+  memcpy(p->reply, text, n);
+  if(echo) {
+    size_t m = item->text_len < sizeof(p->reply) - 1 - n ? item->text_len : sizeof(p->reply) - 1 - n;
+    memcpy(p->reply + n, item->text, m);
+    n += m;
+  }
+  p->reply[n] = 0;
+  p->emit(p->emit_arg, item->target, p->reply, n);
+}
+
+
+
+// Append item to the list of those waiting for node id
+static inline void pipeline_enqueue(Pipeline *p, int32_t id, uint16_t item) {
+  p->next[item] = 0;
+  if(p->tail[id]) {
+    p->next[p->tail[id] - 1] = item + 1;
+  } else {
+    p->head[id] = item + 1;
+    p->active[id / 64] |= 1ull << (id % 64);
+  }
+  p->tail[id] = item + 1;
+}
+
+
+
+static inline void pipeline_route(Pipeline *p, uint32_t id, uint16_t item, bool pass) {
+  int32_t next = pass ? p->nodes.pass[id] : p->nodes.fail[id];
+  if(next >= 0) pipeline_enqueue(p, next, item);
+}
+
+
+
+static void pipeline_run_node(Pipeline *p, uint32_t id, const uint16_t *in, size_t n) {
+  NodeStore *nodes = &p->nodes;
+  switch(nodes->types[id]) {
+#include "nodes/__run.z"
+  default:
+    // Types without XRUN pass everything
+    for(size_t k = 0; k < n; k++) pipeline_route(p, id, in[k], true);
+  }
+}
+
+
+
+void pipeline_flush(Pipeline *p, uint64_t now) {
+  if(!p->num_items) return;
+  p->now = now;
+
+  // Edges only lead to later nodes, so taking the lowest waiting node each
+  // time runs every node after all of its predecessors
+  uint16_t in[PIPELINE_BATCH];
+  for(size_t w = 0; w < p->active_words; w++) {
+    while(p->active[w]) {
+      uint32_t id = w * 64 + __builtin_ctzll(p->active[w]);
+      p->active[w] &= p->active[w] - 1;
+
+      size_t n = 0;
+      for(uint16_t k = p->head[id]; k; k = p->next[k - 1]) in[n++] = k - 1;
+      p->head[id] = p->tail[id] = 0;
+      pipeline_run_node(p, id, in, n);
+    }
+  }
+  p->num_items = 0;
+}
+
+
+
+void pipeline_push(Pipeline *p, Message *m, uint64_t now) {
+  if(!p->nodes.num_nodes || (!p->started && !pipeline_start(p))) return;
+  if(p->num_items == PIPELINE_BATCH) pipeline_flush(p, now);
+
+  PipeItem *item = &p->items[p->num_items];
+  item->command = m->command;
+  item->command_len = m->command_len;
+  item->nick = m->prefix.nick;
+  item->nick_len = m->prefix.nick ? m->prefix.nick_len : 0;
+  if(m->num_args && m->args[0][0] == '#') item->target = m->args[0];
+  else item->target = m->prefix.nick;
+  item->text = m->num_args ? m->args[m->num_args - 1] : "";
+  item->text_len = m->num_args ? m->args_len[m->num_args - 1] : 0;
+
+  pipeline_enqueue(p, 0, p->num_items++);
+}
@@ -0,0 +1,86 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "message.h"
+#include "node.h"
+
+// Message-processing pipeline: a DAG of nodes (see node.h) that messages
+// flow through in batches. Node 0 takes every message; each node sends a
+// message on to its pass or fail node, which always comes later, so one
+// walk over the nodes in order runs the whole batch. A node runs all the
+// messages that reached it before the next node starts, and dispatch is a
+// switch over the node type rather than a call through a pointer, so the
+// per-message work is straight-line code. Nodes nothing reached are
+// skipped without being looked at.
+
+#define PIPELINE_BATCH 256
+
+// What nodes see of a message. Everything points into the message, whose
+// buffer must stay put until the batch runs; transforms narrow text or
+// rewrite it in place.
+typedef struct {
+  const char *command;
+  size_t command_len;
+  const char *nick;
+  size_t nick_len;
+  const char *target; // Where replies go: the channel, or else the sender
+  char *text;         // Last param
+  size_t text_len;
+} PipeItem;
+
+typedef void (*PipeEmit)(void *arg, const char *target, const char *text, size_t len);
+
+typedef struct Pipeline {
+  NodeStore nodes;
+  bool started;
+
+  PipeEmit emit; // Called for every reply; text is NUL-terminated
+  void *emit_arg;
+  uint64_t now;  // Time of the batch being run, in ns
+
+  PipeItem items[PIPELINE_BATCH];
+  size_t num_items;
+
+  // Items waiting for each node, as lists through next. Entries are
+  // item + 1, or 0 for none. active has a bit set per node with a list.
+  uint16_t next[PIPELINE_BATCH];
+  uint16_t *head;
+  uint16_t *tail;
+  uint64_t *active;
+  size_t active_words;
+  char reply[MESSAGE_MAX_LEN];
+} Pipeline;
+
+void pipeline_init(Pipeline *p, PipeEmit emit, void *arg);
+void pipeline_free(Pipeline *p);
+
+// Append a node, as node_store_add() does; set its fields with node_set()
+// on p->nodes. Returns -1 once the pipeline has started.
+int pipeline_add(Pipeline *p, int type, const char *name);
+
+// Set node from's edges; -1 ends a path. Returns false unless both are
+// later nodes or -1.
+bool pipeline_link(Pipeline *p, int from, int pass, int fail);
+
+// Add the nodes described by spec, one per line:
+//   name type [key=value]... [> pass] [! fail]
+// Values with spaces go in double quotes and "-" names no node. # starts a
+// comment. On failure *line gets the offending line number, from 1.
+bool pipeline_load(Pipeline *p, const char *spec, int *line);
+
+// Run every node's setup. Pushing does this itself the first time.
+bool pipeline_start(Pipeline *p);
+
+// Queue m for the next batch, running the current one first if it is full
+void pipeline_push(Pipeline *p, Message *m, uint64_t now);
+
+// Run the queued batch
+void pipeline_flush(Pipeline *p, uint64_t now);
+
+// Used by the reply node: emit text, then the item's text if echo is set
+void pipeline_reply(Pipeline *p, const PipeItem *item, const char *text, size_t len, bool echo);
+
+#endif
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include "ratelimit.h"
+
+
+
+bool bucket_init(TokenBucket *b, unsigned size, uint64_t period) {
+  b->period = period;
+  b->size = size;
+  b->next = 0;
+  b->ready = calloc(size, sizeof(uint64_t));
+  return b->ready != NULL;
+}
+
+
+
+void bucket_free(TokenBucket *b) {
+  free(b->ready);
+  b->ready = NULL;
+}
+
+
+
+unsigned bucket_available(const TokenBucket *b, uint64_t now) {
+  unsigned n = 0;
+  while(n < b->size && b->ready[(b->next + n) % b->size] <= now) n++;
+  return n;
+}
+
+
+
+void bucket_take(TokenBucket *b, unsigned n, uint64_t now) {
+  for(unsigned i = 0; i < n; i++) {
+    b->ready[b->next] = now + b->period;
+    b->next = (b->next + 1) % b->size;
+  }
+}
+
+
+
+uint64_t bucket_ready_at(const TokenBucket *b, unsigned n) {
+  if(n == 0) return 0;
+  if(n > b->size) n = b->size;
+  return b->ready[(b->next + n - 1) % b->size];
+}
@@ -0,0 +1,31 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Token bucket in which each token comes back exactly period after it was
+// spent. No window of length period ever sees more than size tokens taken,
+// which is how limits like Twitch's "20 messages per 30 seconds" are
+// enforced; a bucket that refills at a steady rate could let through up to
+// twice that across a window boundary.
+typedef struct {
+  uint64_t period;
+  unsigned size;
+  unsigned next;   // Token that comes back first
+  uint64_t *ready; // When each token is available again, in ring order
+} TokenBucket;
+
+bool bucket_init(TokenBucket *b, unsigned size, uint64_t period);
+void bucket_free(TokenBucket *b);
+
+// Tokens available at now
+unsigned bucket_available(const TokenBucket *b, uint64_t now);
+
+// Spend n tokens, which must be available
+void bucket_take(TokenBucket *b, unsigned n, uint64_t now);
+
+// When n tokens will be available, at most size
+uint64_t bucket_ready_at(const TokenBucket *b, unsigned n);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SAMPLES_H
+#define SAMPLES_H
+
+// Sample lines for the parser demo and the benchmarks
+#define SAMPLE_MESSAGES \
+X("@badge-info=subscriber/1;badges=subscriber/0;color=;display-name=DinkSmaIIwood;emote-sets=0,97129,111925;mod=0;subscriber=1;user-type= :tmitest-test.twitch.tv USERSTATE #misterscoot") \
+X("@badge-info=founder/34;badges=moderator/1,founder/0,premium/1;color=#8A2BE2;display-name=FatalPierce;emote-only=1;emotes=300462338:0-9;flags=;id=a6ec9527-63bb-47e1-9668-8ddbdf2607ea;mod=1;room-id=100327976;subscriber=0;tmi-sent-ts=1589506867207;turbo=0;user-id=83894115;user-type=mod :fatalpierce!fatalpierce@fatalpierce.tmi.twitch.tv PRIVMSG #misterscoot :gloopdRock") \
+X(":nick!user COMMAND") \
+X(":nick@host.name COMMAND") \
+X(":nick!user@host.name COMMAND") \
+X(":nick COMMAND") \
+X(":host.host COMMAND") \
+X(":nick!user@host.host PRIVMSG #channel :This is a test message")
+
+#endif
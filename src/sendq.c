@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sendq.h"
+
+
+
+static WireBuf *wirebuf_alloc(size_t cap) {
+  WireBuf *b = malloc(sizeof(WireBuf) + cap);
+  if(!b) return NULL;
+  atomic_init(&b->refs, 1);
+  b->len = 0;
+  b->cap = cap;
+  return b;
+}
+
+
+
+WireBuf *wirebuf_new(const char *data, size_t len) {
+  WireBuf *b = wirebuf_alloc(len);
+  if(!b) return NULL;
+  memcpy(b->data, data, len);
+  b->len = len;
+  return b;
+}
+
+
+
+void wirebuf_ref(WireBuf *b) {
+  atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+}
+
+
+
+void wirebuf_unref(WireBuf *b) {
+  if(atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) == 1) free(b);
+}
+
+
+
+static bool append(SendQ *q, WireBuf *b) {
+  if(q->count == q->cap) {
+    size_t cap = q->cap ? q->cap * 2 : 16;
+    WireBuf **bufs = malloc(cap * sizeof(WireBuf *));
+    if(!bufs) return false;
+    for(size_t i = 0; i < q->count; i++) bufs[i] = q->bufs[(q->head + i) & (q->cap - 1)];
+    free(q->bufs);
+    q->bufs = bufs;
+    q->head = 0;
+    q->cap = cap;
+  }
+
+  q->bufs[(q->head + q->count) & (q->cap - 1)] = b;
+  q->count++;
+  q->bytes += b->len;
+  return true;
+}
+
+
+
+bool sendq_push(SendQ *q, const char *data, size_t len) {
+  WireBuf *tail = q->count ? q->bufs[(q->head + q->count - 1) & (q->cap - 1)] : NULL;
+  if(tail && tail->cap - tail->len >= len) {
+    memcpy(tail->data + tail->len, data, len);
+    tail->len += len;
+    q->bytes += len;
+    return true;
+  }
+
+  WireBuf *b = wirebuf_alloc(len > SENDQ_BLOCK ? len : SENDQ_BLOCK);
+  if(!b) return false;
+  memcpy(b->data, data, len);
+  b->len = len;
+  if(append(q, b)) return true;
+  free(b);
+  return false;
+}
+
+
+
+bool sendq_push_shared(SendQ *q, WireBuf *b) {
+  if(!append(q, b)) return false;
+  wirebuf_ref(b);
+  return true;
+}
+
+
+
+int sendq_iov(SendQ *q, struct iovec *iov, int max) {
+  int n = 0;
+  size_t off = q->off;
+  for(size_t i = 0; i < q->count && n < max; i++, off = 0) {
+    WireBuf *b = q->bufs[(q->head + i) & (q->cap - 1)];
+    if(b->len == off) continue;
+    iov[n].iov_base = b->data + off;
+    iov[n].iov_len = b->len - off;
+    n++;
+  }
+  return n;
+}
+
+
+
+void sendq_copy(const SendQ *q, char *dst) {
+  size_t off = q->off;
+  for(size_t i = 0; i < q->count; i++, off = 0) {
+    WireBuf *b = q->bufs[(q->head + i) & (q->cap - 1)];
+    memcpy(dst, b->data + off, b->len - off);
+    dst += b->len - off;
+  }
+}
+
+
+
+void sendq_consume(SendQ *q, size_t n) {
+  q->bytes -= n;
+  n += q->off;
+  while(q->count > 0) {
+    WireBuf *b = q->bufs[q->head];
+    if(n < b->len) break;
+
+    // Keep a drained copy block at the tail for the next push
+    if(q->count == 1 && b->cap > b->len) {
+      b->len = n = 0;
+      break;
+    }
+
+    n -= b->len;
+    q->head = (q->head + 1) & (q->cap - 1);
+    q->count--;
+    wirebuf_unref(b);
+  }
+  q->off = n;
+}
+
+
+
+void sendq_clear(SendQ *q) {
+  for(size_t i = 0; i < q->count; i++) wirebuf_unref(q->bufs[(q->head + i) & (q->cap - 1)]);
+  free(q->bufs);
+  *q = (SendQ){};
+}
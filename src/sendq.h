@@ -0,0 +1,55 @@
+#ifndef SENDQ_H
+#define SENDQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define SENDQ_BLOCK 4096 // Minimum size of a block the queue copies into
+#define SENDQ_IOV 64     // Buffers handed to one writev
+
+// Immutable, refcounted wire bytes. A broadcast is serialized into one of
+// these once and every recipient's queue holds a reference; the last
+// queue to flush it frees it. Queues also use them as copy blocks, which
+// are the only ones with spare room and are never shared.
+typedef struct {
+  atomic_size_t refs;
+  size_t len;
+  size_t cap;
+  char data[];
+} WireBuf;
+
+// Returns a buffer holding one reference, or NULL
+WireBuf *wirebuf_new(const char *data, size_t len);
+void wirebuf_ref(WireBuf *b);
+void wirebuf_unref(WireBuf *b);
+
+// Outbound queue for one connection: a ring of buffers, oldest first.
+// Lines are copied into the tail block until it fills, so one writev covers
+// many lines, and shared buffers are queued by reference.
+typedef struct {
+  WireBuf **bufs;
+  size_t head;
+  size_t count;
+  size_t cap;   // Power of two
+  size_t off;   // Bytes of the head buffer already sent
+  size_t bytes; // Bytes queued and not yet sent
+} SendQ;
+
+// Both return false if memory ran out; nothing is queued then
+bool sendq_push(SendQ *q, const char *data, size_t len);
+bool sendq_push_shared(SendQ *q, WireBuf *b);
+
+// Describe up to max unsent buffers, oldest first. Returns the count.
+int sendq_iov(SendQ *q, struct iovec *iov, int max);
+
+// Copy all q->bytes unsent bytes to dst, leaving the queue as it is
+void sendq_copy(const SendQ *q, char *dst);
+
+// Drop n bytes the kernel accepted
+void sendq_consume(SendQ *q, size_t n);
+
+void sendq_clear(SendQ *q);
+
+#endif
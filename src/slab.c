@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+#define NO_SLOT UINT32_MAX
+
+
+
+bool slab_init(Slab *s, size_t num_columns, const size_t *sizes) {
+  if(num_columns > SLAB_MAX_COLUMNS) return false;
+
+  *s = (Slab){ .num_columns = num_columns, .free_head = NO_SLOT };
+  memcpy(s->sizes, sizes, num_columns * sizeof(size_t));
+  return true;
+}
+
+
+
+static bool grow(Slab *s) {
+  size_t n = s->num_chunks;
+  size_t cap = (n + 1) * SLAB_CHUNK;
+  if(cap > NO_SLOT) return false;
+
+  uint32_t *generations = realloc(s->generations, cap * sizeof(uint32_t));
+  if(!generations) return false;
+  s->generations = generations;
+
+  uint32_t *next_free = realloc(s->next_free, cap * sizeof(uint32_t));
+  if(!next_free) return false;
+  s->next_free = next_free;
+
+  for(size_t col = 0; col < s->num_columns; col++) {
+    char **chunks = realloc(s->chunks[col], (n + 1) * sizeof(char *));
+    if(!chunks) return false;
+    s->chunks[col] = chunks;
+
+    chunks[n] = calloc(SLAB_CHUNK, s->sizes[col]);
+    if(!chunks[n]) {
+      for(size_t i = 0; i < col; i++) free(s->chunks[i][n]);
+      return false;
+    }
+  }
+
+  // Thread the new slots onto the free list, lowest index first
+  for(size_t i = cap; i-- > n * SLAB_CHUNK;) {
+    s->generations[i] = 0;
+    s->next_free[i] = s->free_head;
+    s->free_head = i;
+  }
+
+  s->num_chunks++;
+  return true;
+}
+
+
+
+// Returns a handle to zeroed objects, or 0 if memory ran out
+SlabHandle slab_alloc(Slab *s) {
+  if(s->free_head == NO_SLOT && !grow(s)) return 0;
+
+  uint32_t index = s->free_head;
+  s->free_head = s->next_free[index];
+  s->generations[index]++;
+  s->count++;
+
+  return (SlabHandle)s->generations[index] << 32 | index;
+}
+
+
+
+void slab_free(Slab *s, SlabHandle h) {
+  if(!slab_get(s, 0, h)) return;
+  uint32_t index = SLAB_INDEX(h);
+
+  for(size_t col = 0; col < s->num_columns; col++) {
+    memset(slab_at(s, col, index), 0, s->sizes[col]);
+  }
+
+  s->generations[index]++;
+  s->next_free[index] = s->free_head;
+  s->free_head = index;
+  s->count--;
+}
+
+
+
+void *slab_get(Slab *s, size_t column, SlabHandle h) {
+  uint32_t index = SLAB_INDEX(h);
+  if(index >= s->num_chunks * SLAB_CHUNK) return NULL;
+  if(s->generations[index] != SLAB_GENERATION(h)) return NULL;
+  if(!(SLAB_GENERATION(h) & 1)) return NULL;
+  return slab_at(s, column, index);
+}
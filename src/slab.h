@@ -0,0 +1,47 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_MAX_COLUMNS 4
+#define SLAB_CHUNK 256 // Objects per chunk
+
+// Generation in the high half, index in the low half. A slot's generation
+// is odd while it is live and even while it is free, so 0 is never a valid
+// handle.
+typedef uint64_t SlabHandle;
+
+#define SLAB_INDEX(h) ((uint32_t)(h))
+#define SLAB_GENERATION(h) ((uint32_t)((h) >> 32))
+
+// Growable pool of objects with a free list. Each slot has one object per
+// column, stored column by column, so hot and cold parts of the same
+// object live in separate arrays. Storage grows in fixed chunks and never
+// moves, so pointers stay valid until the slot is freed. Freeing bumps the
+// slot's generation, which invalidates every outstanding handle to it.
+typedef struct {
+  size_t num_columns;
+  size_t sizes[SLAB_MAX_COLUMNS];
+  char **chunks[SLAB_MAX_COLUMNS];
+  size_t num_chunks;
+
+  uint32_t *generations;
+  uint32_t *next_free;
+  uint32_t free_head;
+  size_t count;
+} Slab;
+
+bool slab_init(Slab *s, size_t num_columns, const size_t *sizes);
+SlabHandle slab_alloc(Slab *s);
+void slab_free(Slab *s, SlabHandle h);
+
+// Object in column for h, or NULL if h is stale
+void *slab_get(Slab *s, size_t column, SlabHandle h);
+
+static inline void *slab_at(Slab *s, size_t column, uint32_t index) {
+  return s->chunks[column][index / SLAB_CHUNK] + (index % SLAB_CHUNK) * s->sizes[column];
+}
+
+#endif
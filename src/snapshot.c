@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "snapshot.h"
+
+#define SNAP_MAGIC 0x52484243 // "CBHR"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t num_fds;
+  uint64_t len;
+} SnapHeader;
+
+
+
+static bool reserve(SnapWriter *w, size_t n) {
+  if(w->failed) return false;
+  if(w->len + n <= w->cap) return true;
+
+  size_t cap = w->cap ? w->cap : 4096;
+  while(cap < w->len + n) cap *= 2;
+  char *data = realloc(w->data, cap);
+  if(!data) {
+    w->failed = true;
+    return false;
+  }
+  w->data = data;
+  w->cap = cap;
+  return true;
+}
+
+
+
+void snap_put_u8(SnapWriter *w, uint8_t v) {
+  if(reserve(w, 1)) w->data[w->len++] = v;
+}
+
+
+
+void snap_put_u32(SnapWriter *w, uint32_t v) {
+  if(!reserve(w, sizeof(v))) return;
+  memcpy(w->data + w->len, &v, sizeof(v));
+  w->len += sizeof(v);
+}
+
+
+
+void *snap_put_blob(SnapWriter *w, uint32_t len) {
+  snap_put_u32(w, len);
+  if(!reserve(w, len)) return NULL;
+  void *p = w->data + w->len;
+  w->len += len;
+  return p;
+}
+
+
+
+void snap_put_str(SnapWriter *w, const char *s, size_t len) {
+  void *p = snap_put_blob(w, len);
+  if(p) memcpy(p, s, len);
+}
+
+
+
+void snap_writer_free(SnapWriter *w) {
+  free(w->data);
+  *w = (SnapWriter){};
+}
+
+
+
+static bool take(SnapReader *r, size_t n) {
+  if(r->failed || r->len - r->pos < n) {
+    r->failed = true;
+    return false;
+  }
+  return true;
+}
+
+
+
+uint8_t snap_get_u8(SnapReader *r) {
+  return take(r, 1) ? (uint8_t)r->data[r->pos++] : 0;
+}
+
+
+
+uint32_t snap_get_u32(SnapReader *r) {
+  uint32_t v = 0;
+  if(!take(r, sizeof(v))) return 0;
+  memcpy(&v, r->data + r->pos, sizeof(v));
+  r->pos += sizeof(v);
+  return v;
+}
+
+
+
+const char *snap_get_blob(SnapReader *r, uint32_t *len) {
+  *len = snap_get_u32(r);
+  if(!take(r, *len)) {
+    *len = 0;
+    return NULL;
+  }
+  const char *p = r->data + r->pos;
+  r->pos += *len;
+  return p;
+}
+
+
+
+// One message, with up to SNAP_FDS_PER_MSG fds attached
+static bool send_msg(int sock, const void *data, size_t len, const int *fds, uint32_t num_fds) {
+  char control[CMSG_SPACE(SNAP_FDS_PER_MSG * sizeof(int))] = {};
+  struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+  if(num_fds) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+  }
+
+  ssize_t n;
+  while((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+  return n == len;
+}
+
+
+
+// Receive one message of exactly len bytes, adding any fds to fds
+static bool recv_msg(int sock, void *data, size_t len, int *fds, uint32_t *num_fds, uint32_t max_fds) {
+  char control[CMSG_SPACE(SNAP_FDS_PER_MSG * sizeof(int))];
+  struct iovec iov = { .iov_base = data, .iov_len = len };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+
+  ssize_t n;
+  while((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+  if(n != len || msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) return false;
+
+  for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+    uint32_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for(uint32_t i = 0; i < n; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      if(*num_fds < max_fds) fds[(*num_fds)++] = fd;
+      else close(fd);
+    }
+  }
+  return true;
+}
+
+
+
+bool snap_send(int sock, const SnapWriter *w, const int *fds, uint32_t num_fds) {
+  if(w->failed) return false;
+
+  SnapHeader h = { .magic = SNAP_MAGIC, .num_fds = num_fds, .len = w->len };
+  if(!send_msg(sock, &h, sizeof(h), NULL, 0)) return false;
+
+  for(uint32_t i = 0; i < num_fds; i += SNAP_FDS_PER_MSG) {
+    uint32_t n = num_fds - i < SNAP_FDS_PER_MSG ? num_fds - i : SNAP_FDS_PER_MSG;
+    if(!send_msg(sock, &n, sizeof(n), fds + i, n)) return false;
+  }
+
+  for(size_t off = 0; off < w->len; off += SNAP_CHUNK) {
+    size_t n = w->len - off < SNAP_CHUNK ? w->len - off : SNAP_CHUNK;
+    if(!send_msg(sock, w->data + off, n, NULL, 0)) return false;
+  }
+  return true;
+}
+
+
+
+bool snap_recv(int sock, char **data, size_t *len, int **fds, uint32_t *num_fds) {
+  SnapHeader h;
+  uint32_t got = 0;
+  *data = NULL;
+  *fds = NULL;
+  if(!recv_msg(sock, &h, sizeof(h), NULL, &got, 0) || h.magic != SNAP_MAGIC) return false;
+
+  *fds = malloc((h.num_fds + 1) * sizeof(int));
+  *data = malloc(h.len + 1);
+  if(!*fds || !*data) goto fail;
+
+  while(got < h.num_fds) {
+    uint32_t n, before = got;
+    if(!recv_msg(sock, &n, sizeof(n), *fds, &got, h.num_fds) || got - before != n) goto fail;
+  }
+
+  for(size_t off = 0; off < h.len; off += SNAP_CHUNK) {
+    size_t n = h.len - off < SNAP_CHUNK ? h.len - off : SNAP_CHUNK;
+    if(!recv_msg(sock, *data + off, n, NULL, &got, 0)) goto fail;
+  }
+
+  *len = h.len;
+  *num_fds = got;
+  return true;
+
+fail:
+  for(uint32_t i = 0; i < got; i++) close((*fds)[i]);
+  free(*fds);
+  free(*data);
+  *fds = NULL;
+  *data = NULL;
+  return false;
+}
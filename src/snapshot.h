@@ -0,0 +1,52 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary snapshots for handing state to another process, and the
+// transport that sends one with a set of file descriptors over a Unix
+// SOCK_SEQPACKET socket. Integers are written in host byte order: both ends
+// run on the same machine.
+
+#define SNAP_FDS_PER_MSG 250 // SCM_RIGHTS takes at most 253
+#define SNAP_CHUNK 32768     // Bytes of snapshot per message
+
+// Appends to a growing buffer. A failed allocation sets failed and turns
+// later writes into no-ops, so callers check once at the end.
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+  bool failed;
+} SnapWriter;
+
+void snap_put_u8(SnapWriter *w, uint8_t v);
+void snap_put_u32(SnapWriter *w, uint32_t v);
+// Writes len and returns room for len bytes, or NULL
+void *snap_put_blob(SnapWriter *w, uint32_t len);
+void snap_put_str(SnapWriter *w, const char *s, size_t len);
+void snap_writer_free(SnapWriter *w);
+
+// Reads from a buffer. Reading past the end sets failed and yields zeros.
+typedef struct {
+  const char *data;
+  size_t len;
+  size_t pos;
+  bool failed;
+} SnapReader;
+
+uint8_t snap_get_u8(SnapReader *r);
+uint32_t snap_get_u32(SnapReader *r);
+// Points into the buffer, or NULL with *len 0
+const char *snap_get_blob(SnapReader *r, uint32_t *len);
+
+// Send w's bytes and fds over sock, which is left open. The fds stay open
+// here too.
+bool snap_send(int sock, const SnapWriter *w, const int *fds, uint32_t num_fds);
+
+// Receive what snap_send() sent. *data and *fds are malloc'd.
+bool snap_recv(int sock, char **data, size_t *len, int **fds, uint32_t *num_fds);
+
+#endif
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "trigger.h"
+
+enum {
+  CLASS_OTHER, // Bytes no pattern uses
+  CLASS_START,
+  CLASS_END,
+  FIRST_BYTE_CLASS,
+};
+
+static const char *const kind_names[] = {
+#define X(k) #k,
+TRIGGER_KINDS
+#undef X
+};
+
+
+
+void trigger_init(TriggerSet *t, bool fold) {
+  memset(t, 0, sizeof(*t));
+  t->fold = fold;
+}
+
+
+
+static void drop_automaton(TriggerSet *t) {
+  free(t->next);
+  free(t->out_starts);
+  free(t->outs);
+  t->next = t->out_starts = t->outs = NULL;
+  t->num_states = 0;
+  t->built = false;
+}
+
+
+
+void trigger_free(TriggerSet *t) {
+  drop_automaton(t);
+  free(t->kinds);
+  free(t->starts);
+  free(t->text);
+  trigger_init(t, t->fold);
+}
+
+
+
+int trigger_kind_named(const char *name, size_t len) {
+  for(int i = 0; i < sizeof(kind_names) / sizeof(kind_names[0]); i++) {
+    if(strlen(kind_names[i]) == len && !strncasecmp(kind_names[i], name, len)) return i;
+  }
+  return -1;
+}
+
+
+
+int trigger_add(TriggerSet *t, int kind, const char *s, size_t len) {
+  if(kind < 0 || kind >= sizeof(kind_names) / sizeof(kind_names[0])) return -1;
+  if(len > UINT32_MAX / 4 - t->text_len) return -1;
+
+  if(t->num_patterns == t->cap_patterns) {
+    uint32_t cap = t->cap_patterns ? t->cap_patterns * 2 : 64;
+    uint8_t *kinds = realloc(t->kinds, cap);
+    if(!kinds) return -1;
+    t->kinds = kinds;
+    uint32_t *starts = realloc(t->starts, (cap + 1) * sizeof(uint32_t));
+    if(!starts) return -1;
+    t->starts = starts;
+    t->cap_patterns = cap;
+  }
+  if(t->text_len + len > t->text_cap) {
+    uint32_t cap = t->text_cap ? t->text_cap : 1024;
+    while(cap < t->text_len + len) cap *= 2;
+    char *text = realloc(t->text, cap);
+    if(!text) return -1;
+    t->text = text;
+    t->text_cap = cap;
+  }
+
+  memcpy(t->text + t->text_len, s, len);
+  t->kinds[t->num_patterns] = kind;
+  t->starts[t->num_patterns] = t->text_len;
+  t->text_len += len;
+  t->starts[t->num_patterns + 1] = t->text_len;
+  t->built = false;
+  return t->num_patterns++;
+}
+
+
+
+// Trie under construction. Each inserted symbol string adds its id to the
+// list of the state it ends in.
+typedef struct {
+  TriggerSet *t;
+  uint32_t num_states;
+  uint32_t *own;      // First list entry + 1 per state, or 0
+  uint32_t *own_next; // Next entry + 1, or 0
+  uint32_t *own_ids;
+  uint32_t num_own;
+} Trie;
+
+
+
+static void insert(Trie *trie, const uint16_t *symbols, size_t n, uint32_t id) {
+  TriggerSet *t = trie->t;
+  uint32_t s = 0;
+  for(size_t i = 0; i < n; i++) {
+    uint32_t *to = &t->next[s * t->num_classes + symbols[i]];
+    if(!*to) *to = trie->num_states++;
+    s = *to;
+  }
+
+  trie->own_ids[trie->num_own] = id;
+  trie->own_next[trie->num_own] = trie->own[s];
+  trie->own[s] = ++trie->num_own;
+}
+
+
+
+// Symbols of pattern id, with an end symbol in place of the space for the
+// second spelling of a command
+static size_t spell(const TriggerSet *t, uint32_t id, bool second, uint16_t *out) {
+  const uint8_t *p = (const uint8_t *)t->text + t->starts[id];
+  size_t len = t->starts[id + 1] - t->starts[id];
+  int kind = t->kinds[id];
+
+  size_t n = 0;
+  if(kind != TRIGGER_CONTAINS) out[n++] = CLASS_START;
+  for(size_t i = 0; i < len; i++) out[n++] = t->classes[p[i]];
+  if(kind == TRIGGER_COMMAND) out[n++] = second ? CLASS_END : t->classes[' '];
+  if(kind == TRIGGER_EXACT) out[n++] = CLASS_END;
+  return n;
+}
+
+
+
+static void assign_classes(TriggerSet *t) {
+  for(int b = 0; b < 256; b++) t->classes[b] = CLASS_OTHER;
+  t->num_classes = FIRST_BYTE_CLASS;
+
+  for(uint32_t id = 0; id < t->num_patterns; id++) {
+    bool command = t->kinds[id] == TRIGGER_COMMAND;
+    for(uint32_t i = t->starts[id]; i < t->starts[id + 1] + command; i++) {
+      uint8_t b = i < t->starts[id + 1] ? t->text[i] : ' ';
+      if(t->fold) b = tolower(b);
+      if(t->classes[b] == CLASS_OTHER) t->classes[b] = t->num_classes++;
+    }
+  }
+  if(t->fold) {
+    for(int b = 'A'; b <= 'Z'; b++) t->classes[b] = t->classes[tolower(b)];
+  }
+}
+
+
+
+bool trigger_build(TriggerSet *t) {
+  drop_automaton(t);
+  assign_classes(t);
+
+  // Every symbol may add a state, and commands are inserted twice
+  size_t max_states = 1;
+  uint32_t inserts = 0;
+  for(uint32_t id = 0; id < t->num_patterns; id++) {
+    int copies = t->kinds[id] == TRIGGER_COMMAND ? 2 : 1;
+    max_states += copies * (t->starts[id + 1] - t->starts[id] + 2);
+    inserts += copies;
+  }
+
+  Trie trie = {
+    .t = t,
+    .num_states = 1,
+    .own = calloc(max_states, sizeof(uint32_t)),
+    .own_next = malloc((inserts + 1) * sizeof(uint32_t)),
+    .own_ids = malloc((inserts + 1) * sizeof(uint32_t)),
+  };
+  uint32_t *fail = malloc(max_states * sizeof(uint32_t));
+  uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+  uint16_t *symbols = malloc((t->text_len + 3) * sizeof(uint16_t));
+  t->next = calloc(max_states * t->num_classes, sizeof(uint32_t));
+  t->out_starts = calloc(max_states + 1, sizeof(uint32_t));
+  bool ok = trie.own && trie.own_next && trie.own_ids && fail && queue && symbols &&
+    t->next && t->out_starts;
+  if(!ok) goto done;
+
+  for(uint32_t id = 0; id < t->num_patterns; id++) {
+    insert(&trie, symbols, spell(t, id, false, symbols), id);
+    if(t->kinds[id] == TRIGGER_COMMAND) insert(&trie, symbols, spell(t, id, true, symbols), id);
+  }
+  t->num_states = trie.num_states;
+
+  // Breadth first, so a state's fail state is always done before it. Missing
+  // transitions are filled in from the fail state, which turns the trie
+  // into a DFA; out_starts briefly holds each state's match count.
+  uint32_t nc = t->num_classes;
+  size_t head = 0, tail = 0;
+  fail[0] = 0;
+  queue[tail++] = 0;
+  while(head < tail) {
+    uint32_t s = queue[head++];
+    for(uint32_t e = trie.own[s]; e; e = trie.own_next[e - 1]) t->out_starts[s]++;
+    if(s) t->out_starts[s] += t->out_starts[fail[s]];
+
+    for(uint32_t c = 0; c < nc; c++) {
+      uint32_t *to = &t->next[s * nc + c];
+      uint32_t via_fail = s ? t->next[fail[s] * nc + c] : 0;
+      if(*to) {
+        fail[*to] = via_fail;
+        queue[tail++] = *to;
+      } else {
+        *to = via_fail;
+      }
+    }
+  }
+
+  // Turn counts into offsets, then list each state's own matches followed
+  // by its fail state's
+  uint32_t total = 0;
+  for(uint32_t s = 0; s < t->num_states; s++) {
+    uint32_t n = t->out_starts[s];
+    t->out_starts[s] = total;
+    total += n;
+  }
+  t->out_starts[t->num_states] = total;
+  if(!(t->outs = malloc((total + 1) * sizeof(uint32_t)))) {
+    ok = false;
+    goto done;
+  }
+  for(size_t i = 0; i < tail; i++) {
+    uint32_t s = queue[i];
+    uint32_t n = t->out_starts[s];
+    for(uint32_t e = trie.own[s]; e; e = trie.own_next[e - 1]) t->outs[n++] = trie.own_ids[e - 1];
+    if(s) {
+      uint32_t f = fail[s];
+      memcpy(t->outs + n, t->outs + t->out_starts[f],
+          (t->out_starts[f + 1] - t->out_starts[f]) * sizeof(uint32_t));
+    }
+  }
+
+  uint32_t *next = realloc(t->next, (size_t)t->num_states * nc * sizeof(uint32_t));
+  if(next) t->next = next;
+  t->built = true;
+
+done:
+  free(trie.own);
+  free(trie.own_next);
+  free(trie.own_ids);
+  free(fail);
+  free(queue);
+  free(symbols);
+  if(!ok) drop_automaton(t);
+  return ok;
+}
+
+
+
+// Add the matches of state s to ids, skipping any already there
+static size_t report(const TriggerSet *t, uint32_t s, uint32_t *ids, size_t n, size_t max) {
+  for(uint32_t i = t->out_starts[s]; i < t->out_starts[s + 1] && n < max; i++) {
+    uint32_t id = t->outs[i];
+    size_t k = 0;
+    while(k < n && ids[k] != id) k++;
+    if(k == n) ids[n++] = id;
+  }
+  return n;
+}
+
+
+
+size_t trigger_scan(const TriggerSet *t, const char *s, size_t len, uint32_t *ids, size_t max) {
+  if(!t->built) return 0;
+
+  const uint32_t *next = t->next;
+  const uint32_t *out_starts = t->out_starts;
+  uint32_t nc = t->num_classes;
+  size_t n = 0;
+
+  uint32_t state = next[CLASS_START];
+  if(out_starts[state] != out_starts[state + 1]) n = report(t, state, ids, n, max);
+  for(size_t i = 0; i < len; i++) {
+    state = next[state * nc + t->classes[(uint8_t)s[i]]];
+    if(out_starts[state] != out_starts[state + 1]) n = report(t, state, ids, n, max);
+  }
+  state = next[state * nc + CLASS_END];
+  if(out_starts[state] != out_starts[state + 1]) n = report(t, state, ids, n, max);
+  return n;
+}
@@ -0,0 +1,68 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Multi-pattern matcher for chat text. Every pattern of a set is compiled
+// into one Aho-Corasick automaton, flattened into a full transition table,
+// so a scan reads each byte once and does one table lookup for it however
+// many patterns there are. Bytes are first mapped to classes, one per byte
+// the patterns use (folded together when ignoring case) plus one for all
+// the rest, which keeps the table small.
+//
+// Anchored kinds are patterns over two extra symbols, start and end of
+// text, that the scan feeds around the text, so they share the automaton.
+
+#define TRIGGER_KINDS \
+X(CONTAINS) /* Anywhere in the text */ \
+X(PREFIX)   /* At the start */ \
+X(COMMAND)  /* At the start, followed by a space or the end, as "!cmd" */ \
+X(EXACT)    /* The whole text */
+
+enum {
+#define X(k) TRIGGER_##k,
+TRIGGER_KINDS
+#undef X
+};
+
+typedef struct {
+  bool fold; // Ignore ASCII case
+
+  // Patterns as added, in order
+  uint8_t *kinds;
+  uint32_t *starts; // Offset of each in text, with one past the last
+  char *text;
+  uint32_t num_patterns;
+  uint32_t cap_patterns;
+  uint32_t text_len;
+  uint32_t text_cap;
+
+  // The automaton, once built
+  bool built;
+  uint16_t classes[256]; // Up to 256 byte classes past the 3 fixed ones
+  uint32_t num_classes;
+  uint32_t num_states;
+  uint32_t *next;       // num_states * num_classes
+  uint32_t *out_starts; // Matches on entering state s are
+  uint32_t *outs;       // outs[out_starts[s]..out_starts[s + 1])
+} TriggerSet;
+
+void trigger_init(TriggerSet *t, bool fold);
+void trigger_free(TriggerSet *t);
+
+// Add a pattern and return its id, counting from 0, or -1 if memory ran
+// out. The set must be built again before the next scan.
+int trigger_add(TriggerSet *t, int kind, const char *s, size_t len);
+
+// Kind called name, e.g. "command", or -1
+int trigger_kind_named(const char *name, size_t len);
+
+bool trigger_build(TriggerSet *t);
+
+// Scan s[0..len) and write the ids of up to max patterns that matched, each
+// once, in the order their first match ends. Returns how many were written.
+size_t trigger_scan(const TriggerSet *t, const char *s, size_t len, uint32_t *ids, size_t max);
+
+#endif
@@ -1 +1,20 @@
 #include "identity.x"
+#include "message.x"
+#include "arena.x"
+#include "linebuf.x"
+#include "atom.x"
+#include "channel.x"
+#include "nick.x"
+#include "slab.x"
+#include "sendq.x"
+#include "mpsc.x"
+#include "phash.x"
+#include "metrics.x"
+#include "ratelimit.x"
+#include "bot.x"
+#include "node.x"
+#include "pipeline.x"
+#include "trigger.x"
+#include "snapshot.x"
+#include "log.x"
+#include "server.x"
@@ -0,0 +1,47 @@
+#ifdef XHEAD
+#include "arena.h"
+#include "message.h"
+#else
+X(arena_reuses_chunks_after_reset,
+  Arena a = {};
+  bool ok = true;
+  for(int round = 0; round < 3; round++) {
+    for(int i = 0; i < 100; i++) {
+      char *p = arena_alloc(&a, 1 + i);
+      ok = ok && p && ((size_t)p & 15) == 0;
+      memset(p, i, 1 + i);
+    }
+    ok = ok && arena_alloc(&a, ARENA_CHUNK * 2);
+    arena_reset(&a);
+  }
+  ok = ok && a.mallocs == 3;
+  arena_free(&a);
+  return ok;
+)
+
+X(arena_printf_formats_in_place,
+  Arena a = {};
+  size_t len;
+  char *s = arena_printf(&a, &len, ":%s PRIVMSG %s :%d", "nick", "#chan", 42);
+  char *t = arena_strndup(&a, "abcdef", 3);
+  bool ok = s && !strcmp(s, ":nick PRIVMSG #chan :42") && len == 23 &&
+    t && !strcmp(t, "abc") && a.mallocs == 1;
+  arena_free(&a);
+  return ok;
+)
+
+X(pcre2_parse_into_arena_stops_allocating,
+  Arena a = {};
+  size_t warm = 0;
+  for(int i = 0; i < 50; i++) {
+    Message m = message_new_pcre2("@a=1;b=2 :nick!user@host.name PRIVMSG #chan :hello there\r\n", &a);
+    if(!m.valid || m.owned || strcmp(m.args[1], "hello there")) return false;
+    message_free(&m);
+    arena_reset(&a);
+    if(i == 0) warm = a.mallocs;
+  }
+  bool ok = warm == 1 && a.mallocs == warm;
+  arena_free(&a);
+  return ok;
+)
+#endif
@@ -0,0 +1,24 @@
+#ifdef XHEAD
+#include "atom.h"
+#else
+X(atom_keys_use_rfc1459_mapping,
+  Atom *a = atom_intern("Foo[]\\~", 7);
+  Atom *b = atom_intern("fOO{}|^", 7);
+  Atom *c = atom_intern("Foo[]\\~", 7);
+  bool ok = a && b && a == c && a != b && atom_eq(a, b) &&
+    !strcmp(a->key->name, "foo{}|^") && a->key->key == a->key;
+  atom_release(a);
+  atom_release(b);
+  atom_release(c);
+  return ok;
+)
+
+X(atom_find_needs_a_holder,
+  Atom *a = atom_intern("#Lonely", 7);
+  Atom *found = atom_find("#LONELY", 7);
+  bool ok = found && atom_eq(found, a);
+  atom_release(found);
+  atom_release(a);
+  return ok && !atom_find("#lonely", 7);
+)
+#endif
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "macro_magic.h"
+#include "message.h"
+#include "samples.h"
+
+// B(name, (setup), body) runs body in timed batches after running setup
+// once. setup is parenthesised so it may hold commas; its declarations are
+// in scope in body. The same .x files hold the tests, so X() is ignored here
+// and B() is ignored by test.c.
+#define BENCH_SAMPLES 100
+#define BENCH_BATCH_NS 50000 // Batches are grown until they take this long
+
+#define BENCH_STRIP(...) __VA_ARGS__
+
+// Keep the compiler from dropping a result nobody reads
+#define BENCH_KEEP(x) __asm__ volatile("" :: "g"(x) : "memory")
+
+typedef struct {
+  const char *name;
+  size_t batch; // Iterations in the batch about to run, 0 before the first
+  bool calibrating;
+  uint64_t start;
+  size_t start_allocs;
+
+  int samples;
+  double ns[BENCH_SAMPLES]; // ns/op of each timed batch
+  uint64_t total_ns;
+  size_t iters;
+  size_t allocs;
+} Bench;
+
+
+
+// Allocations made through the C library, by us or by libraries like PCRE2.
+// Everything is handed on to glibc's own allocator.
+size_t bench_allocs;
+
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t n);
+
+void *malloc(size_t n) {
+  bench_allocs++;
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+  bench_allocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+  bench_allocs++;
+  return __libc_realloc(p, n);
+}
+
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+// Called before each batch. Batch sizes double until one takes
+// BENCH_BATCH_NS, which also warms up caches, and then BENCH_SAMPLES batches
+// of that size are timed.
+bool bench_next(Bench *b) {
+  uint64_t t = now_ns() - b->start;
+  size_t allocs = bench_allocs - b->start_allocs;
+
+  if(!b->batch) {
+    b->batch = 1;
+    b->calibrating = true;
+  } else if(b->calibrating) {
+    if(t < BENCH_BATCH_NS) b->batch *= 2;
+    else b->calibrating = false;
+  } else {
+    b->ns[b->samples++] = (double)t / b->batch;
+    b->total_ns += t;
+    b->iters += b->batch;
+    b->allocs += allocs;
+    if(b->samples == BENCH_SAMPLES) return false;
+  }
+
+  b->start_allocs = bench_allocs;
+  b->start = now_ns();
+  return true;
+}
+
+
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+
+void bench_report(Bench *b) {
+  qsort(b->ns, b->samples, sizeof(double), cmp_double);
+  double ns = (double)b->total_ns / b->iters;
+  printf("%-32s %10.1f ns/op %14.0f ops/s %8.2f allocs/op   p50 %.1f  p90 %.1f  p99 %.1f\n",
+      b->name, ns, 1e9 / ns, (double)b->allocs / b->iters,
+      b->ns[b->samples / 2], b->ns[b->samples * 9 / 10], b->ns[b->samples * 99 / 100]);
+}
+
+
+
+// Inputs shared by the suites: the sample corpus, a line with every tag
+// slot used and a long trailing parameter, and a stream of ~1 MiB of both
+const char *bench_corpus[] = {
+#define X(s) s,
+SAMPLE_MESSAGES
+#undef X
+};
+#define BENCH_CORPUS_LEN (sizeof(bench_corpus) / sizeof(bench_corpus[0]))
+
+char bench_tagged[MESSAGE_MAX_LEN];
+size_t bench_tagged_len;
+
+char *bench_stream;
+size_t bench_stream_len;
+
+static void bench_inputs(void) {
+  size_t n = 0;
+  n += sprintf(bench_tagged + n, "@");
+  for(int i = 0; i < MESSAGE_MAX_TAGS; i++) {
+    n += sprintf(bench_tagged + n, "%skey-%d=value\\s%d", i ? ";" : "", i, i);
+  }
+  n += sprintf(bench_tagged + n, " :nick!user@host.name PRIVMSG #channel :");
+  while(n < MESSAGE_MAX_LEN - 64) n += sprintf(bench_tagged + n, "lorem ipsum ");
+  bench_tagged_len = n;
+
+  size_t cap = 1 << 20;
+  bench_stream = malloc(cap + MESSAGE_MAX_LEN);
+  for(size_t i = 0; bench_stream_len < cap; i++) {
+    const char *s = i % 16 ? bench_corpus[i % BENCH_CORPUS_LEN] : bench_tagged;
+    bench_stream_len += sprintf(bench_stream + bench_stream_len, "%s\r\n", s);
+  }
+}
+
+
+
+#define XHEAD
+#include "_all.x"
+#undef XHEAD
+
+#define X(...)
+#define B(n, setup, ...) \
+  void P(bench_,n)(void) { \
+    Bench bench = { .name = PS(n) }; \
+    BENCH_STRIP setup; \
+    while(bench_next(&bench)) { \
+      for(size_t bench_i = bench.batch; bench_i--;) { __VA_ARGS__ } \
+    } \
+    bench_report(&bench); \
+  }
+#include "_all.x"
+#undef B
+
+int main(int argc, char *argv[]) {
+  bench_inputs();
+
+  // Optional arguments pick benchmarks by substring
+#define B(n,...) \
+  for(int i = argc > 1 ? 1 : 0; i < argc; i++) { \
+    if(!i || strstr(PS(n), argv[i])) { \
+      P(bench_,n)(); \
+      break; \
+    } \
+  }
+#include "_all.x"
+#undef B
+#undef X
+
+  return 0;
+}
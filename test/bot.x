@@ -0,0 +1,77 @@
+#ifdef XHEAD
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "bot.h"
+
+static inline void bot_count(Bot *bot, Message *m, void *arg) {
+  (*(int *)arg)++;
+}
+#else
+X(bot_sends_pong_ahead_of_queued_chat,
+  static Bot bot;
+  static char out[4096];
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) return false;
+  BotConfig config = { .nick = "b", .msg_limit = 1 };
+  if(!bot_init(&bot, &config) || !bot_attach(&bot, fds[0])) return false;
+
+  bot_privmsg(&bot, BOT_LANE_CHAT, "#c", "one");
+  bot_privmsg(&bot, BOT_LANE_CHAT, "#c", "two");
+  const char *in = ":s 001 b :Welcome\r\nPING :x\r\n";
+  write(fds[1], in, strlen(in));
+  bot_input(&bot);
+  uint64_t wake = bot_pump(&bot, 1000);
+
+  ssize_t n = read(fds[1], out, sizeof(out) - 1);
+  out[n > 0 ? n : 0] = 0;
+  // One message token, so "two" waits for it to come back
+  bool ok = bot.registered && wake == 1000 + bot.config.msg_period &&
+    !strcmp(out, "NICK b\r\nUSER b 0 * :b\r\nPONG :x\r\nPRIVMSG #c :one\r\n");
+  close(fds[1]);
+  bot_free(&bot);
+  return ok;
+)
+
+X(bot_batches_joins_under_the_limit,
+  static Bot bot;
+  static char out[4096];
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) return false;
+  BotConfig config = { .nick = "b", .join_limit = 3 };
+  if(!bot_init(&bot, &config) || !bot_attach(&bot, fds[0])) return false;
+  read(fds[1], out, sizeof(out));
+
+  const char *names[] = { "#a", "#b", "#c", "#d" };
+  for(int i = 0; i < 4; i++) bot_join(&bot, names[i]);
+  bot.registered = true;
+  bot_pump(&bot, 1000);
+  bot_pump(&bot, 1000);
+
+  ssize_t n = read(fds[1], out, sizeof(out) - 1);
+  out[n > 0 ? n : 0] = 0;
+  bool ok = !strcmp(out, "JOIN #a,#b,#c\r\n") && bot.join_next == 3;
+  close(fds[1]);
+  bot_free(&bot);
+  return ok;
+)
+
+X(bot_runs_matching_triggers,
+  static Bot bot;
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) return false;
+  BotConfig config = { .nick = "b" };
+  int hits[2] = {};
+  if(!bot_init(&bot, &config) || !bot_attach(&bot, fds[0]) ||
+      !bot_trigger(&bot, TRIGGER_COMMAND, "!hi", bot_count, &hits[0]) ||
+      !bot_trigger(&bot, TRIGGER_CONTAINS, "cake", bot_count, &hits[1])) return false;
+
+  const char *in = ":u!u@h PRIVMSG #c :!HI cake\r\n:u!u@h PRIVMSG #c :!hint\r\n:u!u@h NOTICE #c :cake\r\n";
+  write(fds[1], in, strlen(in));
+  bot_input(&bot);
+  bool ok = hits[0] == 1 && hits[1] == 1;
+  close(fds[1]);
+  bot_free(&bot);
+  return ok;
+)
+#endif
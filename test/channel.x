@@ -0,0 +1,48 @@
+#ifdef XHEAD
+#include "channel.h"
+#else
+X(channel_join_is_case_insensitive,
+  ChannelTable t = {};
+  Membership a = {};
+  Membership b = {};
+  Atom *name[] = { atom_intern("#Room", 5), atom_intern("#rOOM", 5), atom_intern("#room", 5) };
+  Channel *ch = channel_join(&t, name[0], &a, &a);
+  bool ok = ch && channel_join(&t, name[1], &b, &b) == ch &&
+    ch->num_members == 2 && channel_find(&t, name[2]) == ch && ch->name == name[0];
+  channel_leave(&t, &a);
+  channel_leave(&t, &b);
+  for(int i = 0; i < 3; i++) atom_release(name[i]);
+  return ok;
+)
+
+X(channel_leave_swaps_and_destroys,
+  ChannelTable t = {};
+  Membership mb[3] = {};
+  Atom *name = atom_intern("#c", 2);
+  for(int i = 0; i < 3; i++) channel_join(&t, name, &mb[i], &mb[i]);
+
+  Channel *ch = channel_find(&t, name);
+  channel_leave(&t, &mb[0]);
+  bool ok = ch->num_members == 2 && ch->members[0].mb == &mb[2] && mb[2].index == 0;
+
+  channel_leave(&t, &mb[1]);
+  channel_leave(&t, &mb[2]);
+  ok = ok && !channel_find(&t, name) && t.count == 0 && atomic_load(&name->refs) == 1;
+  atom_release(name);
+  return ok;
+)
+
+X(channel_table_grows,
+  ChannelTable t = {};
+  static Membership mb[500];
+  char name[16];
+  for(int i = 0; i < 500; i++) {
+    int len = snprintf(name, sizeof(name), "#c%d", i);
+    Atom *a = atom_intern(name, len);
+    if(!channel_join(&t, a, &mb[i], &mb[i])) return false;
+    atom_release(a);
+  }
+  Atom *last = atom_find("#C499", 5);
+  return t.count == 500 && t.num_buckets >= 500 && last && channel_find(&t, last);
+)
+#endif
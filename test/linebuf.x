@@ -0,0 +1,58 @@
+#ifdef XHEAD
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "linebuf.h"
+#else
+X(linebuf_scan_finds_newline_past_vector_width,
+  char s[100];
+  memset(s, 'a', sizeof(s));
+  s[70] = '\n';
+  return linebuf_scan(s, sizeof(s)) == 70 && linebuf_scan(s, 70) == 70;
+)
+
+X(linebuf_splits_lines_and_carries_partial,
+  static LineBuf b;
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) return false;
+  linebuf_reset(&b);
+
+  char *line;
+  size_t len;
+  bool ok = true;
+
+  write(fds[1], "NICK a\r\nUSER b c d :e\r\nJOI", 26);
+  ok = ok && linebuf_read(&b, fds[0]) == 26;
+  ok = ok && (line = linebuf_next(&b, &len)) && len == 8 && !memcmp(line, "NICK a\r\n", 8);
+  ok = ok && (line = linebuf_next(&b, &len)) && len == 15;
+  ok = ok && !linebuf_next(&b, &len);
+
+  write(fds[1], "N #c\r\n", 6);
+  ok = ok && linebuf_read(&b, fds[0]) == 6;
+  ok = ok && (line = linebuf_next(&b, &len)) && len == 9 && !memcmp(line, "JOIN #c\r\n", 9);
+
+  close(fds[0]);
+  close(fds[1]);
+  return ok;
+)
+
+X(linebuf_drops_overlong_line,
+  static LineBuf b;
+  static char big[MESSAGE_MAX_LEN+10];
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) return false;
+  linebuf_reset(&b);
+
+  memset(big, 'x', sizeof(big));
+  write(fds[1], big, sizeof(big));
+  write(fds[1], "\r\nPING x\r\n", 10);
+
+  char *line = NULL;
+  size_t len;
+  while(!line && linebuf_read(&b, fds[0]) > 0) line = linebuf_next(&b, &len);
+
+  close(fds[0]);
+  close(fds[1]);
+  return line && len == 8 && !memcmp(line, "PING x\r\n", 8);
+)
+#endif
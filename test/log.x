@@ -0,0 +1,64 @@
+#ifdef XHEAD
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include "log.h"
+
+// Render through a log record into got, then compare with snprintf
+#define LOG_RENDERS_LIKE_PRINTF(...) do { \
+  char want[512], got[512] = ""; \
+  snprintf(want, sizeof(want), __VA_ARGS__); \
+  FILE *f = fmemopen(got, sizeof(got), "w"); \
+  if(!f) return false; \
+  log_render(f, __VA_ARGS__); \
+  fclose(f); \
+  ok = ok && !strcmp(want, got); \
+} while(0)
+
+static inline bool log_renders(const char *want, const char *got) {
+  return !strcmp(want, got);
+}
+#else
+X(log_formats_captured_arguments_like_printf,
+  bool ok = true;
+  int x = 5;
+  LOG_RENDERS_LIKE_PRINTF("plain");
+  LOG_RENDERS_LIKE_PRINTF("%d [%5d] [%-5d] %u %x %c", -3, 42, 7, 9u, 255, 'q');
+  LOG_RENDERS_LIKE_PRINTF("%zu %lld %llu %ld", (size_t)1 << 40, -(1ll << 50), ~0ull, -7l);
+  LOG_RENDERS_LIKE_PRINTF("%p %g %.2f %e", (void *)&x, 0.1, 3.14159, 1e300);
+  LOG_RENDERS_LIKE_PRINTF("100%% of [%s] [%-6s] [%6s]", "abc", "ab", "cd");
+  LOG_RENDERS_LIKE_PRINTF("[%.*s] [%.*s] [%.3s]", 3, "hello", -1, "hello", "world");
+  LOG_RENDERS_LIKE_PRINTF("[%*d] [%*d] [%-*d]", 4, 9, -4, 9, 3, 1);
+  LOG_RENDERS_LIKE_PRINTF("[%s]", (char *)"");
+  return ok;
+)
+
+X(log_falls_back_to_printf_for_other_conversions,
+  bool ok = true;
+  LOG_RENDERS_LIKE_PRINTF("wide %ls", L"text");
+  LOG_RENDERS_LIKE_PRINTF("long double %Lf", (long double)1.5);
+  return ok;
+)
+
+X(log_cuts_strings_that_do_not_fit,
+  char s[300], got[512] = "", want[512];
+  memset(s, 'z', sizeof(s) - 1);
+  s[sizeof(s) - 1] = 0;
+
+  // One word leaves LOG_DATA - 8 bytes, one of them the NUL
+  FILE *f = fmemopen(got, sizeof(got), "w");
+  if(!f) return false;
+  log_render(f, "[%s]", s);
+  fclose(f);
+  snprintf(want, sizeof(want), "[%.*s]...", LOG_DATA - 9, s);
+  bool ok = log_renders(want, got);
+
+  // The first string fills the record, the second finds no room at all
+  f = fmemopen(got, sizeof(got), "w");
+  if(!f) return false;
+  log_render(f, "[%s] [%s] %d", s, "abc", 7);
+  fclose(f);
+  snprintf(want, sizeof(want), "[%.*s] [] 7...", LOG_DATA - 3 * 8 - 1, s);
+  return ok && log_renders(want, got);
+)
+#endif
@@ -0,0 +1,233 @@
+#ifdef XHEAD
+#include <string.h>
+#include "message.h"
+#else
+X(parse_twitch_privmsg,
+  char s[] = "@badges=moderator/1;color=#8A2BE2;flags= :fatalpierce!fatalpierce@fatalpierce.tmi.twitch.tv PRIVMSG #misterscoot :gloopd Rock\r\n";
+  Message m;
+  if(!message_parse(&m, s, strlen(s))) return false;
+  return !m.num_tags && message_tags(&m) == 3 &&
+    !strcmp(m.tags[0].key, "badges") && !strcmp(m.tags[0].value, "moderator/1") &&
+    m.tags[2].value_len == 0 &&
+    !strcmp(m.prefix.nick, "fatalpierce") && m.prefix.nick_len == 11 &&
+    !strcmp(m.prefix.host, "fatalpierce.tmi.twitch.tv") &&
+    !strcmp(m.command, "PRIVMSG") &&
+    m.num_args == 2 &&
+    !strcmp(m.args[1], "gloopd Rock") && m.args_len[1] == 11;
+)
+
+X(parse_server_prefix,
+  char s[] = ":host.host 001 nick :Welcome";
+  Message m;
+  return message_parse(&m, s, strlen(s)) &&
+    !m.prefix.nick && !strcmp(m.prefix.host, "host.host") &&
+    !strcmp(m.command, "001") && m.num_args == 2;
+)
+
+X(get_tag_unescapes_only_what_is_read,
+  char s[] = "@room-id=1;msg=a\\sb;flag;msg=again;raw=x\\sy :n!u@h PRIVMSG #c :hi";
+  Message m;
+  if(!message_parse(&m, s, strlen(s))) return false;
+
+  size_t len;
+  const char *msg = message_get_tag(&m, "msg", &len);
+  const char *flag = message_get_tag(&m, "flag", NULL);
+  const char *id = message_get_tag(&m, "room-id", NULL);
+  return msg && !strcmp(msg, "again") && len == 5 &&
+    flag && !*flag && id && !strcmp(id, "1") &&
+    !message_get_tag(&m, "missing", NULL) && !message_get_tag(&m, "room", NULL) &&
+    !strcmp(m.tags[1].value, "a\\sb") && !strcmp(m.tags[4].value, "x\\sy");
+)
+
+X(get_tag_unescape_rules,
+  char s[] = "@a=x\\sy\\:z\\\\w\\q\\ CMD";
+  Message m;
+  if(!message_parse(&m, s, strlen(s))) return false;
+  size_t len;
+  const char *a = message_get_tag(&m, "a", &len);
+  return a && !strcmp(a, "x y;z\\wq") && len == 8;
+)
+
+X(parse_rejects_bad_command,
+  char s[] = "PRIV1MSG #chan :hi\r\n";
+  Message m;
+  return !message_parse(&m, s, strlen(s));
+)
+
+X(parse_rejects_embedded_newline,
+  char s[] = "PRIVMSG #chan :a\nb\r\n";
+  Message m;
+  return !message_parse(&m, s, strlen(s));
+)
+
+X(parse_caps_args,
+  char s[] = "CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17";
+  Message m;
+  return message_parse(&m, s, strlen(s)) &&
+    m.num_args == MESSAGE_MAX_ARGS &&
+    !strcmp(m.args[MESSAGE_MAX_ARGS-1], "16 17");
+)
+
+X(parse_matches_pcre2_reference,
+  char *lines[] = {
+    ":nick!user@host.name PRIVMSG #channel :This is a test message\r\n",
+    "@a=1;b=2 :nick@host.name JOIN #chan\r\n",
+    "NICK someone\r\n",
+  };
+  for(int i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+    char s[MESSAGE_MAX_LEN+1];
+    strcpy(s, lines[i]);
+    Message a = message_new_pcre2(lines[i], NULL);
+    Message b;
+    message_parse(&b, s, strlen(s));
+    message_tags(&b);
+    bool same = a.valid == b.valid &&
+      a.num_tags == b.num_tags &&
+      a.num_args == b.num_args &&
+      !strcmp(a.command, b.command);
+    for(int j = 0; same && j < a.num_args; j++) {
+      same = a.args_len[j] == b.args_len[j] && !strcmp(a.args[j], b.args[j]);
+    }
+    message_free(&a);
+    if(!same) return false;
+  }
+  return true;
+)
+
+X(tostring_round_trips,
+  char s[] = "@a=x\\sy;flag :nick!user@host.name PRIVMSG #chan :hello there";
+  Message m;
+  if(!message_parse(&m, s, strlen(s))) return false;
+  message_get_tag(&m, "a", NULL);
+  char out[MESSAGE_MAX_LEN];
+  size_t len;
+  return message_tostring(&m, out, sizeof(out), &len) &&
+    !strcmp(out, "@a=x\\sy;flag :nick!user@host.name PRIVMSG #chan :hello there") &&
+    len == strlen(out);
+)
+
+X(tostring_rejects_unparsed_message,
+  char s[] = ":prefix.only";
+  Message m;
+  if(message_parse(&m, s, strlen(s))) return false;
+  char out[16];
+  size_t len = 99;
+  return !message_tostring(&m, out, sizeof(out), &len) && len == 0 && !*out;
+)
+
+X(tostring_reports_overflow,
+  char s[] = "NICK someone";
+  Message m;
+  if(!message_parse(&m, s, strlen(s))) return false;
+  char out[8];
+  size_t len;
+  return !message_tostring(&m, out, sizeof(out), &len) &&
+    len == 6 && !strcmp(out, "NICK s");
+)
+
+X(builder_writes_whole_lines,
+  char buf[64];
+  MessageBuilder b;
+  message_build_init(&b, buf, sizeof(buf));
+  message_build_prefix(&b, "nick", "user", "host.name");
+  message_build_command(&b, "PRIVMSG");
+  message_build_param(&b, "#chan", 5);
+  message_build_trailing(&b, "hi all", 6);
+  size_t len = message_build_end(&b);
+  if(b.overflow || len != 44 || memcmp(buf, ":nick!user@host.name PRIVMSG #chan :hi all\r\n", len)) return false;
+
+  char small[10];
+  message_build_init(&b, small, sizeof(small));
+  message_build_command(&b, "PRIVMSG");
+  message_build_trailing(&b, "hi all", 6);
+  len = message_build_end(&b);
+  return b.overflow && len == 10 && !memcmp(small, "PRIVMSG \r\n", len);
+)
+
+X(parse_batch_stops_at_partial_line,
+  char s[] = "NICK a\r\n\r\nPRIVMSG #c :hi\nBAD1 x\r\nJOIN #";
+  Message m[4];
+  size_t used;
+  size_t n = message_parse_batch(s, strlen(s), m, 4, &used);
+  if(n != 3 || used != 33 || strcmp(s + used, "JOIN #")) return false;
+  if(!m[0].valid || strcmp(m[0].args[0], "a")) return false;
+  if(!m[1].valid || strcmp(m[1].args[1], "hi") || m[2].valid) return false;
+
+  char t[] = "NICK a\r\nNICK b\r\n";
+  n = message_parse_batch(t, strlen(t), m, 1, &used);
+  return n == 1 && used == 8;
+)
+
+B(message_new_corpus,
+  (char line[MESSAGE_MAX_LEN]; size_t k = 0),
+  const char *s = bench_corpus[k++ % BENCH_CORPUS_LEN];
+  strcpy(line, s);
+  Message m = message_new(line);
+  BENCH_KEEP(m.num_args);
+)
+
+B(message_new_tagged,
+  (char line[MESSAGE_MAX_LEN]),
+  memcpy(line, bench_tagged, bench_tagged_len + 1);
+  Message m = message_new(line);
+  BENCH_KEEP(message_tags(&m));
+)
+
+B(message_new_pcre2_corpus,
+  (size_t k = 0),
+  Message m = message_new_pcre2((char *)bench_corpus[k++ % BENCH_CORPUS_LEN], NULL);
+  BENCH_KEEP(m.num_args);
+  message_free(&m);
+)
+
+B(message_parse_batch_1mib,
+  (static Message out[256]; char *buf = malloc(bench_stream_len)),
+  memcpy(buf, bench_stream, bench_stream_len);
+  size_t pos = 0, used;
+  while(message_parse_batch(buf + pos, bench_stream_len - pos, out, 256, &used)) pos += used;
+  BENCH_KEEP(pos);
+)
+
+B(message_tostring_corpus,
+  (Message m[BENCH_CORPUS_LEN]; char lines[BENCH_CORPUS_LEN][MESSAGE_MAX_LEN];
+   char out[MESSAGE_MAX_LEN]; size_t k = 0;
+   for(size_t i = 0; i < BENCH_CORPUS_LEN; i++) {
+     strcpy(lines[i], bench_corpus[i]);
+     m[i] = message_new(lines[i]);
+   }),
+  size_t len;
+  message_tostring(&m[k++ % BENCH_CORPUS_LEN], out, sizeof(out), &len);
+  BENCH_KEEP(len);
+)
+
+B(message_tostring_tagged_escaped,
+  (char line[MESSAGE_MAX_LEN]; char out[MESSAGE_MAX_LEN];
+   memcpy(line, bench_tagged, bench_tagged_len + 1);
+   Message m = message_new(line);
+   message_get_tag(&m, "key-0", NULL)),
+  size_t len;
+  message_tostring(&m, out, sizeof(out), &len);
+  BENCH_KEEP(len);
+)
+
+B(message_build_privmsg,
+  (char out[MESSAGE_MAX_LEN]),
+  MessageBuilder b;
+  message_build_init(&b, out, sizeof(out));
+  message_build_raw(&b, ":nick!user@host.name ", 21);
+  message_build_command(&b, "PRIVMSG");
+  message_build_param(&b, "#channel", 8);
+  message_build_trailing(&b, "This is a test message", 22);
+  BENCH_KEEP(message_build_end(&b));
+)
+
+B(message_is_nick_valid,
+  (char *nicks[] = { "nick", "Some_Nick[away]", "9invalid", "averylongnickname" }; size_t k = 0),
+  BENCH_KEEP(message_is_nick_valid(nicks[k++ % 4]));
+)
+
+B(message_is_channel_valid,
+  (char *chans[] = { "#chan", "#misterscoot", "&local", "no-hash" }; size_t k = 0),
+  BENCH_KEEP(message_is_channel_valid(chans[k++ % 4]));
+)
+#endif
@@ -0,0 +1,35 @@
+#ifdef XHEAD
+#include "metrics.h"
+#else
+X(hist_percentiles_within_a_bucket,
+  static Histogram h;
+  for(uint64_t v = 1; v <= 1000; v++) hist_record(&h, v * 1000);
+  uint64_t p50 = hist_percentile(&h, 0.5);
+  uint64_t p99 = hist_percentile(&h, 0.99);
+  return h.count == 1000 && h.max == 1000000 &&
+    p50 >= 500000 && p50 <= 500000 + 500000 / 16 &&
+    p99 >= 990000 && p99 <= 1000000 &&
+    hist_percentile(&h, 1) == 1000000;
+)
+
+X(hist_small_values_are_exact,
+  static Histogram h;
+  hist_record(&h, 0);
+  hist_record(&h, 3);
+  hist_record(&h, 3);
+  hist_record(&h, 31);
+  return hist_percentile(&h, 0.25) == 0 && hist_percentile(&h, 0.75) == 3 &&
+    hist_percentile(&h, 1) == 31;
+)
+
+X(metrics_sum_adds_registered_threads,
+  metrics_register();
+  Metrics before, after;
+  metrics_sum(&before);
+  metric_add(&metrics.lines_in, 5);
+  hist_record(&metrics.fanout, 7);
+  metrics_sum(&after);
+  return after.lines_in == before.lines_in + 5 &&
+    after.fanout.count == before.fanout.count + 1;
+)
+#endif
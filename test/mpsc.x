@@ -0,0 +1,69 @@
+#ifdef XHEAD
+#include <pthread.h>
+#include "mpsc.h"
+
+#define MPSC_TEST_PRODUCERS 4
+#define MPSC_TEST_ITEMS 50000
+
+typedef struct {
+  MpscNode node;
+  int producer;
+  int seq;
+} MpscTestItem;
+
+typedef struct {
+  Mpsc *q;
+  MpscTestItem *items;
+  atomic_int *done;
+} MpscTestProducer;
+
+static inline void *mpsc_test_produce(void *arg) {
+  MpscTestProducer *p = arg;
+  for(int i = 0; i < MPSC_TEST_ITEMS; i++) mpsc_push(p->q, &p->items[i].node);
+  atomic_fetch_add(p->done, 1);
+  return NULL;
+}
+#else
+X(mpsc_push_reports_empty_queue,
+  Mpsc q = {};
+  MpscNode a, b;
+  bool ok = mpsc_push(&q, &a) && !mpsc_push(&q, &b);
+  MpscNode *n = mpsc_take(&q);
+  ok = ok && n == &a && n->next == &b && !b.next && !mpsc_take(&q);
+  return ok && mpsc_push(&q, &a);
+)
+
+X(mpsc_keeps_each_producers_order,
+  static MpscTestItem items[MPSC_TEST_PRODUCERS][MPSC_TEST_ITEMS];
+  static Mpsc q;
+  atomic_int done = 0;
+  MpscTestProducer producers[MPSC_TEST_PRODUCERS];
+  pthread_t threads[MPSC_TEST_PRODUCERS];
+
+  for(int p = 0; p < MPSC_TEST_PRODUCERS; p++) {
+    for(int i = 0; i < MPSC_TEST_ITEMS; i++) items[p][i] = (MpscTestItem){ .producer = p, .seq = i };
+    producers[p] = (MpscTestProducer){ .q = &q, .items = items[p], .done = &done };
+  }
+  for(int p = 0; p < MPSC_TEST_PRODUCERS; p++) {
+    if(pthread_create(&threads[p], NULL, mpsc_test_produce, &producers[p])) return false;
+  }
+
+  // Take batches while the producers run, and once more after they finish
+  int next[MPSC_TEST_PRODUCERS] = {};
+  bool ok = true;
+  bool finished;
+  do {
+    finished = atomic_load(&done) == MPSC_TEST_PRODUCERS;
+    for(MpscNode *n = mpsc_take(&q); n; n = n->next) {
+      MpscTestItem *item = (MpscTestItem *)n;
+      ok = ok && item->seq == next[item->producer]++;
+    }
+  } while(!finished);
+
+  for(int p = 0; p < MPSC_TEST_PRODUCERS; p++) {
+    pthread_join(threads[p], NULL);
+    ok = ok && next[p] == MPSC_TEST_ITEMS;
+  }
+  return ok;
+)
+#endif
@@ -0,0 +1,32 @@
+#ifdef XHEAD
+#include "nick.h"
+#else
+X(nick_add_rejects_case_variants,
+  NickTable t = {};
+  Atom *alice = atom_intern("Alice", 5);
+  Atom *other = atom_intern("aLICE", 5);
+  int a;
+  int b;
+  bool ok = nick_add(&t, alice, &a) && !nick_add(&t, other, &b) &&
+    nick_find(&t, other) == &a && t.count == 1;
+  atom_release(alice);
+  atom_release(other);
+  return ok;
+)
+
+X(nick_remove_keeps_probe_chains,
+  NickTable t = {};
+  static Atom *names[1000];
+  char name[8];
+  for(int i = 0; i < 1000; i++) {
+    int len = snprintf(name, sizeof(name), "n%d", i);
+    names[i] = atom_intern(name, len);
+    if(!nick_add(&t, names[i], names[i])) return false;
+  }
+  for(int i = 0; i < 1000; i += 2) nick_remove(&t, names[i]);
+  for(int i = 0; i < 1000; i++) {
+    if((nick_find(&t, names[i]) != NULL) != (i % 2 == 1)) return false;
+  }
+  return t.count == 500;
+)
+#endif
@@ -0,0 +1,54 @@
+#ifdef XHEAD
+#include <stdio.h>
+#include <string.h>
+#include "node.h"
+#include "pipeline.h"
+
+// A chain of n filters, every tenth named
+static void node_chain(NodeStore *nodes, int n) {
+  for(int i = 0; i < n; i++) {
+    char name[16];
+    int len = snprintf(name, sizeof(name), "n%d", i);
+    int id = node_store_add(nodes, NODE_FILTER, i % 10 ? NULL : name, len);
+    node_set(nodes, id, "command", "PRIVMSG", 7);
+  }
+}
+#else
+X(node_store_pools_payloads_by_type,
+  NodeStore nodes;
+  node_store_init(&nodes);
+  node_chain(&nodes, 10000);
+  int m = node_store_add(&nodes, NODE_MATCH, "m", 1);
+  bool ok = m == 10000 && nodes.filter.len == 10000 && nodes.match.len == 1 &&
+    nodes.slots[m] == 0 && nodes.types[9990] == NODE_FILTER && nodes.pass[9999] == 10000 &&
+    node_store_find(&nodes, "n9990", 5) == 9990 && node_store_find(&nodes, "n9991", 5) == -1 &&
+    node_store_find(&nodes, "m", 1) == m && node_store_add(&nodes, NODE_MATCH, "n50", 3) == -1 &&
+    !strcmp(NODE_AT(&nodes, 9990, filter)->command, "PRIVMSG") &&
+    node_set(&nodes, m, "prefix", "!x", 2) && !node_set(&nodes, m, "command", "x", 1) &&
+    NODE_AT(&nodes, m, match)->prefix_len == 2 && nodes.names[10] && !nodes.names[11];
+  node_store_free(&nodes);
+  return ok;
+)
+
+B(node_store_build_10k,
+  (),
+  NodeStore nodes;
+  node_store_init(&nodes);
+  node_chain(&nodes, 10000);
+  BENCH_KEEP(nodes.num_nodes);
+  node_store_free(&nodes);
+)
+
+B(pipeline_chain_4096,
+  (static Pipeline p; static char lines[PIPELINE_BATCH][64]; static Message m[PIPELINE_BATCH];
+   pipeline_init(&p, NULL, NULL);
+   node_chain(&p.nodes, 4096);
+   for(int i = 0; i < PIPELINE_BATCH; i++) {
+     sprintf(lines[i], ":n%d!u@h PRIVMSG #c :hello", i);
+     message_parse(&m[i], lines[i], strlen(lines[i]));
+   }),
+  for(int i = 0; i < PIPELINE_BATCH; i++) pipeline_push(&p, &m[i], 0);
+  pipeline_flush(&p, 0);
+  BENCH_KEEP(p.num_items);
+)
+#endif
@@ -0,0 +1,41 @@
+#ifdef XHEAD
+#include "phash.h"
+#else
+X(phash_finds_every_key_ignoring_case,
+  static const char *const keys[] = {
+    "NICK", "USER", "JOIN", "PART", "PRIVMSG", "NOTICE", "QUIT", "PING", "PONG",
+    "MODE", "TOPIC", "KICK", "WHO", "WHOIS", "LIST", "NAMES", "AWAY", "001"
+  };
+  size_t n = sizeof(keys) / sizeof(keys[0]);
+  PHash h;
+  if(!phash_build(&h, keys, n)) return false;
+  for(size_t i = 0; i < n; i++) {
+    if(phash_find(&h, keys[i], strlen(keys[i])) != i) return false;
+  }
+  return phash_find(&h, "privMsg", 7) == 4 && phash_find(&h, "PRIVMSGX", 7) == 4;
+)
+
+X(phash_rejects_unknown_keys,
+  static const char *const keys[] = { "NICK", "JOIN" };
+  PHash h;
+  return phash_build(&h, keys, 2) && phash_find(&h, "NIC", 3) == -1 &&
+    phash_find(&h, "NICKS", 5) == -1 && phash_find(&h, "FOO", 3) == -1 &&
+    phash_find(&h, "", 0) == -1;
+)
+
+B(phash_dispatch_corpus,
+  (static const char *const keys[] = {
+     "NICK", "USER", "JOIN", "PART", "PRIVMSG", "NOTICE", "QUIT"
+   };
+   static const char *const commands[] = {
+     "PRIVMSG", "privmsg", "JOIN", "NOTICE", "USERSTATE", "COMMAND", "PING", "QUIT"
+   };
+   size_t lens[8];
+   for(int i = 0; i < 8; i++) lens[i] = strlen(commands[i]);
+   PHash h;
+   phash_build(&h, keys, 7);
+   size_t k = 0),
+  size_t i = k++ % 8;
+  BENCH_KEEP(phash_find(&h, commands[i], lens[i]));
+)
+#endif
@@ -0,0 +1,119 @@
+#ifdef XHEAD
+#include <string.h>
+#include "pipeline.h"
+
+static char pipeline_out[1024];
+static size_t pipeline_replies;
+
+static void pipeline_collect(void *arg, const char *target, const char *text, size_t len) {
+  size_t n = strlen(pipeline_out);
+  snprintf(pipeline_out + n, sizeof(pipeline_out) - n, "%s:%s;", target, text);
+  pipeline_replies++;
+}
+#else
+X(pipeline_routes_batch_through_dag,
+  static Pipeline p;
+  pipeline_init(&p, pipeline_collect, NULL);
+  const char *spec =
+    "chat   filter command=PRIVMSG ! -\n"
+    "ping   match prefix=!ping ! echo\n"
+    "limit  ratelimit limit=2 period_ms=1000\n"
+    "pong   reply text=pong > -\n"
+    "# Anything else that starts with !echo\n"
+    "echo   match prefix=\"!echo \"\n"
+    "strip  transform skip=6 trim=1 upper=1\n"
+    "say    reply text=\"you said \" echo=1\n";
+  pipeline_out[0] = 0;
+  int line;
+  if(!pipeline_load(&p, spec, &line) || p.nodes.num_nodes != 7) return false;
+
+  char lines[][64] = {
+    ":a!u@h PRIVMSG #c :!ping",
+    ":b!u@h PRIVMSG me :!echo  hi there ",
+    ":c!u@h NOTICE #c :!ping",
+    ":d!u@h PRIVMSG #c :!ping",
+    ":e!u@h PRIVMSG #c :!ping",
+    ":f!u@h PRIVMSG #c :hello",
+  };
+  Message m[6];
+  for(int i = 0; i < 6; i++) {
+    if(!message_parse(&m[i], lines[i], strlen(lines[i]))) return false;
+    pipeline_push(&p, &m[i], 1000);
+  }
+  bool ok = pipeline_replies == 0;
+  pipeline_flush(&p, 1000);
+  // The limit lets two pings through; replies come out node by node
+  ok = ok && !strcmp(pipeline_out, "#c:pong;#c:pong;b:you said HI THERE;");
+  pipeline_free(&p);
+  return ok;
+)
+
+// Only ASCII changes case; UTF-8 bytes pass through untouched
+X(pipeline_transform_keeps_high_bytes,
+  static Pipeline p;
+  pipeline_init(&p, pipeline_collect, NULL);
+  const char *spec =
+    "up     match prefix=\"!up \" ! down\n"
+    "upper  transform skip=4 upper=1\n"
+    "say    reply echo=1 > -\n"
+    "down   transform skip=6 lower=1\n"
+    "say2   reply echo=1\n";
+  pipeline_out[0] = 0;
+  pipeline_replies = 0;
+  int line;
+  if(!pipeline_load(&p, spec, &line)) return false;
+
+  char lines[][64] = {
+    ":a!u@h PRIVMSG #c :!up gr\xc3\xbc\xc3\x9f e \xc3\x80" "b",
+    ":a!u@h PRIVMSG #c :!down \xc3\x89" "COLE \xff\x80Z",
+  };
+  Message m[2];
+  for(int i = 0; i < 2; i++) {
+    if(!message_parse(&m[i], lines[i], strlen(lines[i]))) return false;
+    pipeline_push(&p, &m[i], 1000);
+  }
+  pipeline_flush(&p, 1000);
+  bool ok = !strcmp(pipeline_out,
+      "#c:GR\xc3\xbc\xc3\x9f E \xc3\x80" "B;#c:\xc3\x89" "cole \xff\x80z;");
+  pipeline_free(&p);
+  return ok;
+)
+
+X(pipeline_load_rejects_bad_specs,
+  static Pipeline p;
+  int line;
+  const char *bad[] = {
+    "a filter\nb nosuchtype\n",
+    "a filter\nb match > a\n",
+    "a filter color=red\n",
+    "a filter > nowhere\n",
+    "a filter\na match\n",
+  };
+  int lines[] = { 2, 2, 1, 1, 2 };
+  pipeline_init(&p, NULL, NULL);
+  for(int i = 0; i < 5; i++) {
+    bool ok = pipeline_load(&p, bad[i], &line);
+    pipeline_free(&p);
+    if(ok || line != lines[i]) return false;
+  }
+  bool ok = pipeline_load(&p, "\n# only a comment\n  a empty  \n", &line) &&
+    p.nodes.num_nodes == 1 && p.nodes.pass[0] == -1 && node_type_named("RateLimit", 9) == NODE_RATELIMIT;
+  pipeline_free(&p);
+  return ok;
+)
+
+B(pipeline_flush_batch,
+  (static Pipeline p; static char lines[PIPELINE_BATCH][64]; static Message m[PIPELINE_BATCH];
+   int line;
+   pipeline_init(&p, pipeline_collect, NULL);
+   pipeline_load(&p, "chat filter command=PRIVMSG\nping match prefix=!ping\npong reply text=pong\n", &line);
+   for(int i = 0; i < PIPELINE_BATCH; i++) {
+     sprintf(lines[i], ":n%d!u@h PRIVMSG #c :%s", i, i % 8 ? "hello there" : "!ping");
+     message_parse(&m[i], lines[i], strlen(lines[i]));
+   }),
+  pipeline_out[0] = 0;
+  for(int i = 0; i < PIPELINE_BATCH; i++) pipeline_push(&p, &m[i], 0);
+  pipeline_flush(&p, 0);
+  BENCH_KEEP(pipeline_replies);
+)
+#endif
@@ -0,0 +1,16 @@
+#ifdef XHEAD
+#include "ratelimit.h"
+#else
+X(bucket_allows_size_per_period,
+  TokenBucket b;
+  if(!bucket_init(&b, 3, 100)) return false;
+  bool ok = bucket_available(&b, 1000) == 3;
+  bucket_take(&b, 2, 1000);
+  bucket_take(&b, 1, 1050);
+  ok = ok && bucket_available(&b, 1099) == 0 &&
+    bucket_ready_at(&b, 1) == 1100 && bucket_ready_at(&b, 3) == 1150 &&
+    bucket_available(&b, 1100) == 2 && bucket_available(&b, 1150) == 3;
+  bucket_free(&b);
+  return ok;
+)
+#endif
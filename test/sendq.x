@@ -0,0 +1,62 @@
+#ifdef XHEAD
+#include "sendq.h"
+#else
+X(sendq_coalesces_lines_into_blocks,
+  SendQ q = {};
+  static char line[100];
+  memset(line, 'x', sizeof(line));
+  for(int i = 0; i < 100; i++) {
+    if(!sendq_push(&q, line, sizeof(line))) return false;
+  }
+
+  struct iovec iov[SENDQ_IOV];
+  int n = sendq_iov(&q, iov, SENDQ_IOV);
+  bool ok = n == 3 && iov[0].iov_len == 4000 && q.bytes == 10000 &&
+    iov[0].iov_len + iov[1].iov_len + iov[2].iov_len == 10000;
+  sendq_clear(&q);
+  return ok;
+)
+
+X(sendq_consume_resumes_mid_block,
+  SendQ q = {};
+  char data[SENDQ_BLOCK + 10];
+  for(int i = 0; i < sizeof(data); i++) data[i] = i;
+  if(!sendq_push(&q, data, sizeof(data))) return false;
+
+  sendq_consume(&q, SENDQ_BLOCK + 4);
+  struct iovec iov[SENDQ_IOV];
+  int n = sendq_iov(&q, iov, SENDQ_IOV);
+  bool ok = n == 1 && iov[0].iov_len == 6 &&
+    !memcmp(iov[0].iov_base, data + SENDQ_BLOCK + 4, 6);
+
+  sendq_consume(&q, 6);
+  ok = ok && q.bytes == 0 && q.count == 0 && sendq_iov(&q, iov, SENDQ_IOV) == 0 &&
+    sendq_push(&q, "ab", 2) && q.bytes == 2;
+  sendq_clear(&q);
+  return ok;
+)
+
+X(sendq_shares_buffers_by_reference,
+  SendQ a = {};
+  SendQ b = {};
+  WireBuf *buf = wirebuf_new("hello\r\n", 7);
+  if(!buf || !sendq_push(&a, "x", 1) || !sendq_push_shared(&a, buf) ||
+      !sendq_push_shared(&b, buf) || !sendq_push(&a, "y", 1)) return false;
+
+  struct iovec iov[SENDQ_IOV];
+  bool ok = atomic_load(&buf->refs) == 3 && sendq_iov(&a, iov, SENDQ_IOV) == 3 &&
+    iov[1].iov_base == buf->data && a.bytes == 9;
+  char copy[9];
+  sendq_consume(&a, 1);
+  sendq_copy(&a, copy);
+  ok = ok && !memcmp(copy, "hello\r\ny", 8);
+
+  sendq_consume(&b, 7);
+  ok = ok && atomic_load(&buf->refs) == 2;
+  sendq_clear(&a);
+  sendq_clear(&b);
+  ok = ok && atomic_load(&buf->refs) == 1;
+  wirebuf_unref(buf);
+  return ok;
+)
+#endif
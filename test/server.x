@@ -0,0 +1,158 @@
+#ifdef XHEAD
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef TEST_SERVER
+#define TEST_SERVER "build/release/server"
+#endif
+
+#define TEST_FLOOD_LINES 7000
+
+typedef struct {
+  int fd;
+  size_t len;
+  char buf[65536];
+} TestClient;
+
+static inline int test_connect(int port, int rcvbuf) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) return -1;
+  if(rcvbuf) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) },
+  };
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Run the server with two shards, so deliveries also cross between them,
+// and room for the flood below in each send queue. Returns once it listens.
+static inline pid_t test_server_start(const char *backend, int port) {
+  char port_arg[16];
+  snprintf(port_arg, sizeof(port_arg), "%d", port);
+  pid_t pid = fork();
+  if(pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    execl(TEST_SERVER, TEST_SERVER, "-b", backend, "-p", port_arg, "-t", "2",
+        "-q", "65536,8388608", (char *)NULL);
+    _exit(127);
+  }
+  if(pid < 0) return -1;
+
+  for(int i = 0; i < 200; i++) {
+    int fd = test_connect(port, 0);
+    if(fd >= 0) {
+      close(fd);
+      return pid;
+    }
+    usleep(10000);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+static inline bool test_send(TestClient *c, const char *s) {
+  size_t len = strlen(s);
+  return write(c->fd, s, len) == len;
+}
+
+// Read until want arrives and drop everything up to its end
+static inline bool test_expect(TestClient *c, const char *want) {
+  size_t n = strlen(want);
+  while(1) {
+    char *p = memmem(c->buf, c->len, want, n);
+    if(p) {
+      c->len -= p + n - c->buf;
+      memmove(c->buf, p + n, c->len);
+      return true;
+    }
+    // Keep enough to match across reads
+    if(c->len == sizeof(c->buf)) {
+      memmove(c->buf, c->buf + c->len - n, n);
+      c->len = n;
+    }
+    if(poll(&(struct pollfd){ .fd = c->fd, .events = POLLIN }, 1, 2000) != 1) return false;
+    ssize_t got = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+    if(got <= 0) return false;
+    c->len += got;
+  }
+}
+
+static inline bool test_register(TestClient *c, int port, int rcvbuf, const char *nick) {
+  char line[128];
+  c->len = 0;
+  c->fd = test_connect(port, rcvbuf);
+  snprintf(line, sizeof(line), "NICK %s\r\nUSER %s h s :%s\r\nJOIN #t\r\n", nick, nick, nick);
+  bool ok = c->fd >= 0 && test_send(c, line);
+  snprintf(line, sizeof(line), " 001 %s ", nick);
+  ok = ok && test_expect(c, line);
+  snprintf(line, sizeof(line), ":%s!%s@h JOIN #t", nick, nick);
+  return ok && test_expect(c, line);
+}
+
+// Registration, JOIN, channel and direct PRIVMSG, then a flood to the
+// channel that two clients don't read until it is over. The one with a
+// tiny receive buffer keeps the server writing partially, and both must
+// still get every line in order.
+static inline bool test_server_session(const char *backend) {
+  static TestClient a, b, c;
+  int port = 20000 + getpid() % 20000;
+  pid_t pid = test_server_start(backend, port);
+  if(pid < 0) return false;
+
+  bool ok = test_register(&a, port, 0, "alice") &&
+    test_register(&b, port, 0, "bob") &&
+    test_expect(&a, ":bob!bob@h JOIN #t") &&
+    test_register(&c, port, 4096, "carol");
+
+  ok = ok && test_send(&a, "PRIVMSG #t :hi all\r\n") &&
+    test_expect(&b, ":alice!alice@h PRIVMSG #t :hi all") &&
+    test_expect(&c, ":alice!alice@h PRIVMSG #t :hi all");
+  ok = ok && test_send(&b, "PRIVMSG alice :direct\r\n") &&
+    test_expect(&a, ":bob!bob@h PRIVMSG alice :direct");
+
+  char line[320], want[32];
+  memset(line, 'x', sizeof(line));
+  for(int i = 0; ok && i < TEST_FLOOD_LINES; i++) {
+    int n = snprintf(line, sizeof(line), "PRIVMSG #t :%05d ", i);
+    line[n] = 'x';
+    memcpy(line + sizeof(line) - 3, "\r\n", 3);
+    ok = test_send(&a, line);
+  }
+  for(int i = 0; ok && i < TEST_FLOOD_LINES; i++) {
+    snprintf(want, sizeof(want), "#t :%05d x", i);
+    ok = test_expect(&c, want) && test_expect(&b, want);
+  }
+
+  close(a.fd);
+  close(b.fd);
+  close(c.fd);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  return ok;
+}
+#else
+X(server_serves_clients_on_epoll,
+  return test_server_session("epoll");
+)
+
+X(server_serves_clients_on_io_uring,
+  return test_server_session("io_uring");
+)
+#endif
@@ -0,0 +1,25 @@
+#ifdef XHEAD
+#include "slab.h"
+#else
+X(slab_handles_go_stale_on_free,
+  Slab s = {};
+  if(!slab_init(&s, 2, (size_t[]){ 8, 32 })) return false;
+  SlabHandle a = slab_alloc(&s);
+  int *p = slab_get(&s, 1, a);
+  slab_free(&s, a);
+  SlabHandle b = slab_alloc(&s);
+  return a && b && SLAB_INDEX(a) == SLAB_INDEX(b) && a != b &&
+    !slab_get(&s, 1, a) && slab_get(&s, 1, b) == p && *p == 0;
+)
+
+X(slab_grows_without_moving_objects,
+  Slab s = {};
+  if(!slab_init(&s, 1, (size_t[]){ 16 })) return false;
+  SlabHandle first = slab_alloc(&s);
+  void *p = slab_get(&s, 0, first);
+  for(int i = 0; i < SLAB_CHUNK * 3; i++) {
+    if(!slab_alloc(&s)) return false;
+  }
+  return slab_get(&s, 0, first) == p && s.count == SLAB_CHUNK * 3 + 1;
+)
+#endif
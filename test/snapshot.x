@@ -0,0 +1,59 @@
+#ifdef XHEAD
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "snapshot.h"
+#else
+X(snapshot_reads_back_what_was_written,
+  SnapWriter w = {};
+  snap_put_u8(&w, 7);
+  snap_put_u32(&w, 123456);
+  snap_put_str(&w, "nick", 4);
+  snap_put_str(&w, "", 0);
+
+  SnapReader r = { .data = w.data, .len = w.len };
+  uint32_t len;
+  const char *s;
+  bool ok = !w.failed && snap_get_u8(&r) == 7 && snap_get_u32(&r) == 123456 &&
+    (s = snap_get_blob(&r, &len)) && len == 4 && !memcmp(s, "nick", 4) &&
+    snap_get_blob(&r, &len) && len == 0 && !r.failed;
+  ok = ok && snap_get_u32(&r) == 0 && r.failed;
+  snap_writer_free(&w);
+  return ok;
+)
+
+X(snapshot_sends_data_and_fds_in_batches,
+  int sv[2], pipefd[2], fds[SNAP_FDS_PER_MSG + 10];
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) || pipe(pipefd)) return false;
+  uint32_t num_fds = sizeof(fds) / sizeof(fds[0]);
+  for(uint32_t i = 0; i < num_fds; i++) fds[i] = pipefd[1];
+
+  SnapWriter w = {};
+  char *p = snap_put_blob(&w, SNAP_CHUNK + 100);
+  if(p) memset(p, 'x', SNAP_CHUNK + 100);
+  bool ok = snap_send(sv[0], &w, fds, num_fds);
+
+  char *data;
+  size_t len;
+  int *got;
+  uint32_t num_got;
+  ok = ok && snap_recv(sv[1], &data, &len, &got, &num_got) &&
+    len == w.len && !memcmp(data, w.data, len) && num_got == num_fds;
+
+  // Every fd received is the pipe's write end
+  char c = 0;
+  ok = ok && write(got[num_got - 1], "y", 1) == 1 && read(pipefd[0], &c, 1) == 1 && c == 'y';
+  for(uint32_t i = 0; ok && i < num_got; i++) close(got[i]);
+  if(ok) {
+    free(data);
+    free(got);
+  }
+  snap_writer_free(&w);
+  close(sv[0]);
+  close(sv[1]);
+  close(pipefd[0]);
+  close(pipefd[1]);
+  return ok;
+)
+#endif
@@ -1,12 +1,16 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include "macro_magic.h"
 
+// Benchmarks share the .x files; see bench.c
+#define B(...)
+
 #define XHEAD
 #include "_all.x"
 #undef XHEAD
 
-#define X(n,b) bool P(test_,n)(void) { b }
+#define X(n,...) bool P(test_,n)(void) { __VA_ARGS__ }
 #include "_all.x"
 #undef X
 
@@ -0,0 +1,107 @@
+#ifdef XHEAD
+#include <stdio.h>
+#include <string.h>
+#include "trigger.h"
+
+static inline size_t trigger_scan_str(TriggerSet *t, const char *s, uint32_t *ids) {
+  return trigger_scan(t, s, strlen(s), ids, 16);
+}
+
+// n "!cmdN" commands and as many "wordN" phrases
+static void trigger_many(TriggerSet *t, int n) {
+  char s[32];
+  for(int i = 0; i < n; i++) {
+    trigger_add(t, TRIGGER_COMMAND, s, sprintf(s, "!cmd%d", i));
+    trigger_add(t, TRIGGER_CONTAINS, s, sprintf(s, "word%d", i));
+  }
+  trigger_build(t);
+}
+#else
+X(trigger_reports_overlapping_matches_once,
+  TriggerSet t;
+  trigger_init(&t, false);
+  trigger_add(&t, TRIGGER_CONTAINS, "he", 2);
+  trigger_add(&t, TRIGGER_CONTAINS, "she", 3);
+  trigger_add(&t, TRIGGER_CONTAINS, "hers", 4);
+  trigger_add(&t, TRIGGER_CONTAINS, "his", 3);
+  if(!trigger_build(&t)) return false;
+
+  uint32_t ids[16];
+  bool ok = trigger_scan_str(&t, "ushers", ids) == 3 && ids[0] == 1 && ids[1] == 0 && ids[2] == 2 &&
+    trigger_scan_str(&t, "he he he", ids) == 1 && ids[0] == 0 &&
+    trigger_scan_str(&t, "HIS", ids) == 0 &&
+    trigger_scan(&t, "ushers", 6, ids, 1) == 1 && ids[0] == 1;
+  trigger_free(&t);
+  return ok;
+)
+
+// Every byte value gets its own class, past what a byte can count
+X(trigger_handles_patterns_over_every_byte,
+  TriggerSet t;
+  trigger_init(&t, false);
+  for(int b = 0; b < 256; b++) trigger_add(&t, TRIGGER_CONTAINS, &(char){ b }, 1);
+  trigger_add(&t, TRIGGER_EXACT, "ab", 2);
+  trigger_add(&t, TRIGGER_PREFIX, "q", 1);
+  if(!trigger_build(&t)) return false;
+
+  char all[256];
+  for(int b = 0; b < 256; b++) all[b] = b;
+  uint32_t ids[300];
+  bool ok = trigger_scan(&t, all, sizeof(all), ids, 300) == 256 && ids[0] == 0 && ids[255] == 255;
+  // The last bytes must not pass for the start or end of the text
+  ok = ok && trigger_scan(&t, "x\xfeq", 3, ids, 300) == 3 &&
+    ids[0] == 'x' && ids[1] == 0xfe && ids[2] == 'q';
+  ok = ok && trigger_scan(&t, "ab\xff", 3, ids, 300) == 3 &&
+    ids[0] == 'a' && ids[1] == 'b' && ids[2] == 0xff;
+  ok = ok && trigger_scan(&t, "ab", 2, ids, 300) == 3 && ids[2] == 256;
+  trigger_free(&t);
+  return ok;
+)
+
+X(trigger_anchors_prefix_command_and_exact,
+  TriggerSet t;
+  trigger_init(&t, true);
+  int cmd = trigger_add(&t, TRIGGER_COMMAND, "!ping", 5);
+  int pre = trigger_add(&t, TRIGGER_PREFIX, "hi", 2);
+  int exact = trigger_add(&t, TRIGGER_EXACT, "gg", 2);
+  if(!trigger_build(&t)) return false;
+
+  uint32_t ids[16];
+  bool ok = trigger_scan_str(&t, "!PING", ids) == 1 && ids[0] == cmd &&
+    trigger_scan_str(&t, "!ping me", ids) == 1 &&
+    trigger_scan_str(&t, "!pingpong", ids) == 0 &&
+    trigger_scan_str(&t, "say !ping", ids) == 0 &&
+    trigger_scan_str(&t, "Hi there", ids) == 1 && ids[0] == pre &&
+    trigger_scan_str(&t, "oh hi", ids) == 0 &&
+    trigger_scan_str(&t, "GG", ids) == 1 && ids[0] == exact &&
+    trigger_scan_str(&t, "gg wp", ids) == 0 &&
+    trigger_kind_named("Exact", 5) == TRIGGER_EXACT;
+  trigger_free(&t);
+  return ok;
+)
+
+X(trigger_scales_to_many_patterns,
+  TriggerSet t;
+  trigger_init(&t, true);
+  trigger_many(&t, 1000);
+  uint32_t ids[16];
+  // word1 ends inside word12
+  bool ok = trigger_scan_str(&t, "!cmd999 about word5 and word12", ids) == 4 &&
+    ids[0] == 1998 && ids[1] == 11 && ids[2] == 3 && ids[3] == 25 &&
+    trigger_scan_str(&t, "!cmd1000", ids) == 0;
+  trigger_free(&t);
+  return ok;
+)
+
+B(trigger_scan_10,
+  (TriggerSet t; uint32_t ids[16]; size_t k = 0; trigger_init(&t, true); trigger_many(&t, 5)),
+  const char *s = bench_corpus[k++ % BENCH_CORPUS_LEN];
+  BENCH_KEEP(trigger_scan(&t, s, strlen(s), ids, 16));
+)
+
+B(trigger_scan_1000,
+  (TriggerSet t; uint32_t ids[16]; size_t k = 0; trigger_init(&t, true); trigger_many(&t, 500)),
+  const char *s = bench_corpus[k++ % BENCH_CORPUS_LEN];
+  BENCH_KEEP(trigger_scan(&t, s, strlen(s), ids, 16));
+)
+#endif